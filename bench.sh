@@ -0,0 +1,62 @@
+#!/bin/bash
+# times dblpbibtex on generated bib files of doubling size, without network access
+# parsing should scale linearly: the time per entry should stay roughly constant
+# afterwards the largest bib file is timed with 1, 2, 4 and 8 parse threads, which split it into chunks
+# usage: ./bench.sh [max number of entries] [extra dblpbibtex.cfg lines]...
+
+MAXENTRIES=${1:-256000}
+shift 1 &>/dev/null
+
+rm -rf benchtmp &>/dev/null
+mkdir benchtmp
+cd benchtmp
+
+function make_bib_file
+{
+rm test.bib &>/dev/null
+for ((i=0; i<$1; i+=1000)); do
+	echo "@proceedings{DBLP:conf/bench/$i,"
+	echo "  title     = {Proceedings of Benchmark $i},"
+	echo "  year      = {2019}"
+	echo "}"
+	for ((j=i; j<i+1000 && j<$1; ++j)); do
+		echo "@inproceedings{DBLP:conf/bench/Entry$j,"
+		echo "  author    = {Alice Author and Bob {\\\"{O}}ther},"
+		echo "  title     = {On the {Complexity} of Entry $j, \"quoted\"},"
+		echo "  booktitle = {Benchmark $i},"
+		echo "  pages     = {1--10},"
+		echo "  month     = jan,"
+		echo "  crossref  = {DBLP:conf/bench/$i},"
+		echo "}"
+		echo
+	done
+done > test.bib
+}
+
+echo "bibtex=true" > dblpbibtex.cfg.base
+echo "nodownload=1" >> dblpbibtex.cfg.base
+echo "nonewversioncheck=1" >> dblpbibtex.cfg.base
+echo "noparsecache=1" >> dblpbibtex.cfg.base
+while [ "$1" != "" ]; do
+	echo "$1" >> dblpbibtex.cfg.base
+	shift 1
+done
+cp dblpbibtex.cfg.base dblpbibtex.cfg
+echo "\citation{DBLP:conf/bench/Entry0}" > test.aux
+echo "\bibdata{test}" >> test.aux
+
+TIMEFORMAT="%R"
+entries=0
+for ((n=1000; n<=MAXENTRIES; n*=2)); do
+	make_bib_file $n
+	entries=$n
+	t=$( { time ../dblpbibtex test &> dblpbibtex.log; } 2>&1 )
+	echo "entries: $n size: $(wc -c < test.bib) bytes time: $t s"
+done
+
+for threads in 1 2 4 8; do
+	cp dblpbibtex.cfg.base dblpbibtex.cfg
+	echo "parsethreads=$threads" >> dblpbibtex.cfg
+	t=$( { time ../dblpbibtex test &> dblpbibtex.log; } 2>&1 )
+	echo "entries: $entries parsethreads: $threads time: $t s"
+done
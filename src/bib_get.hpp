@@ -7,47 +7,270 @@
 #define DBLPBIBTEX_BIB_GET_HPP
 
 #include "core.hpp"
-#include "network.hpp"
+#include "transport.hpp"
 #include "bib_parse.hpp"
 
 #include <contrib/string_algo.hpp>
 namespace sa = string_algo;
 
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <map>
+#include <set>
+
 /*** download citations ***/
+negative_cache_t negativecitations; /* keys that could not be resolved in previous runs */
+std::map<std::string, std::string> dblpextracitations; /* from DBLP venue exports and crossref'd entries in DBLP responses: lower case key => bib entry */
+std::vector<std::string> downloadedcitreferences; /* crossrefs of downloaded entries, to be downloaded in the same pass */
+std::set<std::string> speculativecitreferences; /* lower case crossrefs that have been prefetched speculatively */
+
+// returns true if key is in a bib file, has been tried in this run, or has already been downloaded with other entries
+bool citation_known(const std::string& key)
+{
+	std::string lkey = sa::to_lower_copy(key);
+	return bibindex.contains(key) || checkedcitations.count(lkey) != 0 || dblpextracitations.count(lkey) != 0;
+}
+
+void add_downloaded_entry(const std::string& bibentry, bool prepend)
+{
+	std::cout << "Downloaded bibtex entry:" << std::endl << bibentry << std::endl;
+	add_entry_to_mainbibfile(bibentry, prepend);
+	std::string crossref = bibentry_crossref(bibentry);
+	if (!crossref.empty())
+		downloadedcitreferences.push_back(crossref);
+}
+
+// keeps the entries after the first of a DBLP response, i.e., the crossref'd entry in the crossref format
+// returns the first entry
+std::string extract_dblp_entries(const std::string& bib)
+{
+	std::string first;
+	for (auto pos = str_findbibentry(bib); pos < bib.size(); pos = str_findbibentry(bib, pos + 1))
+	{
+		std::string bibentry = extract_bibentry(bib, pos);
+		if (bibentry.empty())
+			continue;
+		if (first.empty())
+			first = bibentry;
+		else
+		{
+			std::string key = sa::to_lower_copy(bibentry_key(bibentry));
+			if (!key.empty())
+				dblpextracitations.insert(std::make_pair(key, bibentry));
+		}
+		pos += bibentry.size() - 1;
+	}
+	return first;
+}
+
+// remember key when the server reported it as not found or without bib entry, but not on network or server errors
+void mark_unresolvable(const std::string& key, const std::string& header)
+{
+	long status = http_response_code(header);
+	if (status == 200 || status == 404 || status == 410)
+		negativecitations.insert(key);
+}
+
+std::string dblp_citation_path(const std::string& key)
+{
+	return "/rec/" + key.substr(5) + ".bib?param=" + std::to_string(params.dblpformat);
+}
+
+std::string dblp_citation_url(const std::string& key)
+{
+	return params.dblpmirrors.front() + dblp_citation_path(key);
+}
+
+// DBLP venue of key 'dblp:conf/crypto/StevensKP16' is stream 'conf/crypto' and year '2016', returns false if unknown
+bool dblp_citation_venue(const std::string& key, std::string& stream, std::string& year)
+{
+	std::string path = key.substr(5);
+	auto slash = path.find_last_of('/');
+	if (slash == std::string::npos || std::count(path.begin(), path.end(), '/') != 2)
+		return false;
+	stream = path.substr(0, slash);
+	// arXiv has far more papers per year than a venue export can return
+	if (sa::iequals(stream, "journals/corr"))
+		return false;
+	// names end in a two digit year, optionally followed by a letter to disambiguate, e.g. 'StevensKP16a'
+	std::string name = sa::trim_right_copy_pred(path.substr(slash + 1), [](char c) { return c >= 'a' && c <= 'z'; });
+	if (name.size() < 3 || !isdigit((unsigned char)name[name.size() - 1]) || !isdigit((unsigned char)name[name.size() - 2])
+		|| isdigit((unsigned char)name[name.size() - 3]))
+		return false;
+	int yy = std::stoi(name.substr(name.size() - 2));
+	std::time_t now = std::time(nullptr);
+	int thisyear = 1900 + std::localtime(&now)->tm_year;
+	year = std::to_string(yy <= (thisyear + 1) % 100 ? 2000 + yy : 1900 + yy);
+	return true;
+}
+
+// table of contents of a DBLP venue in one year, in the chosen DBLP format
+std::string dblp_venue_path(const std::string& stream, const std::string& year)
+{
+	return "/search/publ/api?q=stream:streams/" + stream + ":%20year:" + year + ":&h=1000&format=bib" + std::to_string(params.dblpformat);
+}
+
+std::string cryptoeprint_citation_url(const std::string& key)
+{
+	std::string year = std::string(key.begin()+key.find(':')+1, key.begin()+key.find_last_of(':'));
+	std::string paper = key.substr(key.find_last_of(':')+1);
+	return "https://eprint.iacr.org/eprint-bin/cite.pl?entry=" + year + "/" + paper;
+}
+
+// the transfer can stop once the first bib entry is complete, except for the crossref format
+// where the response continues with the crossref'ed entry
+// the received data is scanned once: the scan continues where the previous call stopped
+class dblp_citation_complete_t {
+public:
+	dblp_citation_complete_t()
+		: _begin(std::string::npos), _pos(0), _depth(0)
+	{
+	}
+
+	bool operator()(const std::string& bib)
+	{
+		if (params.dblpformat == DBLP_FORMAT_EXT_CROSSREF)
+			return false;
+		bib_scanner_t scan(bib.data(), bib.size());
+		if (_begin == std::string::npos)
+		{
+			_begin = str_findbibentry(bib, _pos);
+			if (_begin == std::string::npos)
+			{
+				// the type of an entry starting at the last '@' may still be incomplete
+				std::string::size_type at = bib.rfind('@');
+				_pos = (at == std::string::npos || at < _pos) ? bib.size() : at;
+				return false;
+			}
+			_pos = _begin + 1;
+		}
+		if (_depth == 0)
+		{
+			// find the opening bracket
+			_pos = scan.find('{', _pos);
+			if (_pos >= bib.size())
+				return false;
+			_depth = 1;
+			++_pos;
+		}
+		// find the closing bracket, escaped brackets are not counted
+		for (auto i = scan.next(_pos); i < bib.size(); i = scan.next(_pos))
+		{
+			_pos = i + 1;
+			if (bib[i] == '\\')
+				++_pos;
+			else if (bib[i] == '{')
+				++_depth;
+			else if (bib[i] == '}' && --_depth == 0)
+				return true;
+		}
+		_pos = std::max(_pos, bib.size());
+		return false;
+	}
+
+private:
+	std::string::size_type _begin; /* position of the first bib entry */
+	std::string::size_type _pos; /* where to continue scanning */
+	int _depth; /* number of open brackets of the entry at _pos */
+};
+
+// the bib entry is enclosed in <pre>...</pre>, the rest of the page is not needed
+class cryptoeprint_citation_complete_t {
+public:
+	cryptoeprint_citation_complete_t()
+		: _pos(0)
+	{
+	}
+
+	bool operator()(const std::string& html)
+	{
+		static const std::string pre = "</pre>";
+		auto it = std::search(html.begin() + std::min(_pos, html.size()), html.end(), pre.begin(), pre.end(),
+			[](char c, char lc) { return std::tolower((unsigned char)(c)) == lc; });
+		if (it != html.end())
+			return true;
+		// the end tag may start in the last few characters
+		_pos = html.size() < pre.size() ? 0 : html.size() - pre.size() + 1;
+		return false;
+	}
+
+private:
+	std::string::size_type _pos; /* where to continue searching */
+};
+
+// DBLP requests are hedged to the other DBLP mirrors, the response is cached for the primary url
+url_request_t dblp_request(const std::string& path, const url_complete_t& complete = url_complete_t())
+{
+	url_request_t request(params.dblpmirrors.front() + path, complete);
+	for (std::size_t i = 1; i < params.dblpmirrors.size(); ++i)
+		request.mirrors.push_back(params.dblpmirrors[i] + path);
+	return request;
+}
+
+url_request_t dblp_citation_request(const std::string& key)
+{
+	return dblp_request(dblp_citation_path(key), dblp_citation_complete_t());
+}
+
+url_request_t cryptoeprint_citation_request(const std::string& key)
+{
+	return url_request_t(cryptoeprint_citation_url(key), cryptoeprint_citation_complete_t());
+}
+
+// returns request that download_citation will retrieve for key, or request with empty url for other keys
+url_request_t citation_request(const std::string& key)
+{
+	if (!params.nodblp && sa::istarts_with(key, "dblp:"))
+		return dblp_citation_request(key);
+	if (!params.nocryptoeprint && sa::istarts_with(key, "cryptoeprint:"))
+		return cryptoeprint_citation_request(key);
+	return url_request_t(std::string());
+}
+
 bool download_dblp_citation(const std::string& key, bool prepend = true)
 {
-	std::string url = "https://dblp.org/rec/" + key.substr(5) + ".bib?param=" + std::to_string(params.dblpformat);
-	auto hdr_html = url_get(url);
+	auto it = dblpextracitations.find(sa::to_lower_copy(key));
+	if (it != dblpextracitations.end()) {
+		add_downloaded_entry(it->second, prepend);
+		return true;
+	}
+
+	auto hdr_html = url_transport->get_cached(dblp_citation_request(key));
 	auto& html = hdr_html.second;
-	if (html.empty())
+	if (html.empty()) {
+		mark_unresolvable(key, hdr_html.first);
 		return false;
+	}
 
-	auto bibentry = extract_bibentry(html);
+	auto bibentry = extract_dblp_entries(html);
 
-	if (bibentry.empty())
+	if (bibentry.empty()) {
+		mark_unresolvable(key, hdr_html.first);
 		return false;
-	std::cout << "Downloaded bibtex entry:" << std::endl << bibentry << std::endl;
-	add_entry_to_mainbibfile(bibentry, prepend);
+	}
+	add_downloaded_entry(bibentry, prepend);
 	return true;
 }
 
 bool download_cryptoeprint_citation(const std::string& key, bool prepend = true)
 {
-	std::string year = std::string(key.begin()+key.find(':')+1, key.begin()+key.find_last_of(':'));
-	std::string paper = key.substr(key.find_last_of(':')+1);
-	auto hdr_html = url_get("https://eprint.iacr.org/eprint-bin/cite.pl?entry=" + year + "/" + paper);
+	auto hdr_html = url_transport->get_cached(cryptoeprint_citation_request(key));
 	auto& html = hdr_html.second;
-	if (html.empty())
+	if (html.empty()) {
+		mark_unresolvable(key, hdr_html.first);
 		return false;
+	}
 	html.erase(html.begin(), sa::ifind(html,"<pre>")+5);
 	html.erase(sa::ifind(html,"</pre>"), html.end());
 
 	auto bibentry = extract_bibentry(html);
 
-	if (bibentry.empty())
+	if (bibentry.empty()) {
+		mark_unresolvable(key, hdr_html.first);
 		return false;
-	std::cout << "Downloaded bibtex entry:" << std::endl << bibentry << std::endl;
-	add_entry_to_mainbibfile(bibentry, prepend);
+	}
+	add_downloaded_entry(bibentry, prepend);
 	return true;
 }
 
@@ -85,4 +308,141 @@ bool download_citation(const std::string& key, bool prepend = true)
 	return false;
 }
 
+// returns the DBLP venues (stream, year) with at least params.dblpbulkmin missing keys
+std::set<std::pair<std::string,std::string>> dblp_bulk_venues(const std::vector<std::string>& keys)
+{
+	std::set<std::pair<std::string,std::string>> bulkvenues;
+	if (params.nodblp || params.dblpbulkmin == 0)
+		return bulkvenues;
+	std::map<std::pair<std::string,std::string>, unsigned> venues; /* (stream, year) => number of missing keys */
+	for (auto& key : keys)
+	{
+		std::string stream, year;
+		if (sa::istarts_with(key, "dblp:") && dblpextracitations.count(sa::to_lower_copy(key)) == 0
+			&& dblp_citation_venue(key, stream, year))
+			++venues[std::make_pair(stream, year)];
+	}
+	for (auto& vc : venues)
+		if (vc.second >= params.dblpbulkmin)
+			bulkvenues.insert(vc.first);
+	return bulkvenues;
+}
+
+url_request_t dblp_venue_request(const std::pair<std::string,std::string>& venue)
+{
+	return dblp_request(dblp_venue_path(venue.first, venue.second));
+}
+
+// adds all entries of the DBLP venue export to dblpextracitations, so that also crossrefs found later are available
+// keys are the missing citations in the venue: the export is only used when it contains some of them,
+// since the venue and year are derived from the key names and the export format is not documented by DBLP
+void load_dblp_venue(const std::pair<std::string,std::string>& venue, const std::vector<std::string>& keys)
+{
+	std::string name = "DBLP venue '" + venue.first + "' " + venue.second;
+	// a 304 Not Modified carries the revalidated cached export as body
+	auto hdr_bib = url_transport->get_cached(dblp_venue_request(venue));
+	if (!url_answered(http_response_code(hdr_bib.first), true))
+	{
+		std::cout << "Cannot download " << name << ", downloading its " << keys.size() << " citations separately." << std::endl;
+		return;
+	}
+	const std::string& bib = hdr_bib.second;
+	std::map<std::string, std::string> entries; /* lower case key => bib entry */
+	for (auto pos = str_findbibentry(bib); pos < bib.size(); pos = str_findbibentry(bib, pos + 1))
+	{
+		std::string bibentry = extract_bibentry(bib, pos);
+		std::string key = sa::to_lower_copy(bibentry_key(bibentry));
+		if (key.empty())
+			continue;
+		pos += bibentry.size() - 1;
+		entries.insert(std::make_pair(key, std::move(bibentry)));
+	}
+	std::size_t found = 0;
+	for (auto& key : keys)
+		found += entries.count(sa::to_lower_copy(key));
+	if (found == 0)
+	{
+		std::cout << name << " does not contain any of its " << keys.size() << " citations, downloading them separately." << std::endl;
+		return;
+	}
+	unsigned count = 0;
+	for (auto& entry : entries)
+		if (dblpextracitations.insert(entry).second)
+			++count;
+	std::cout << "Downloaded " << name << ": " << count << " bibtex entries with " << found << " of its " << keys.size() << " citations";
+	if (found < keys.size())
+		std::cout << ", downloading the other " << keys.size() - found << " separately";
+	std::cout << "." << std::endl;
+}
+
+// concurrently download the citations of keys in advance, download_citation then uses the prefetched results
+// DBLP venues with several missing keys are downloaded at once, their keys are only downloaded separately when missing
+void prefetch_citations(const std::vector<std::string>& keys)
+{
+	if (mainbibfile.empty())
+		return;
+	auto bulkvenues = dblp_bulk_venues(keys);
+	std::vector<url_request_t> requests;
+	for (auto& venue : bulkvenues)
+		requests.push_back(dblp_venue_request(venue));
+	std::map<std::pair<std::string,std::string>, std::vector<std::string>> venuekeys; /* venue => its missing keys */
+	for (auto& key : keys)
+	{
+		if (dblpextracitations.count(sa::to_lower_copy(key)) != 0)
+			continue;
+		std::string stream, year;
+		if (!bulkvenues.empty() && sa::istarts_with(key, "dblp:") && dblp_citation_venue(key, stream, year)
+			&& bulkvenues.count(std::make_pair(stream, year)) != 0)
+		{
+			venuekeys[std::make_pair(stream, year)].push_back(key);
+			continue;
+		}
+		url_request_t request = citation_request(key);
+		if (!request.url.empty())
+			requests.push_back(request);
+	}
+	if (requests.size() > 1)
+		url_transport->prefetch(requests, params.paralleldownloads);
+	if (!bulkvenues.empty())
+	{
+		for (auto& vk : venuekeys)
+			load_dblp_venue(vk.first, vk.second);
+		requests.clear();
+		for (auto& vk : venuekeys)
+			for (auto& key : vk.second)
+				if (dblpextracitations.count(sa::to_lower_copy(key)) == 0)
+					requests.push_back(dblp_citation_request(key));
+		if (requests.size() > 1)
+			url_transport->prefetch(requests, params.paralleldownloads);
+	}
+	// speculatively prefetch the crossrefs of the prefetched DBLP entries, that are only known after downloading
+	if (params.nodblp || params.dblpformat != DBLP_FORMAT_EXT_CROSSREF)
+		return;
+	// entries that are not in a venue export or prefetched above, e.g., after a failed download, are downloaded concurrently
+	requests.clear();
+	for (auto& key : keys)
+		if (sa::istarts_with(key, "dblp:") && dblpextracitations.count(sa::to_lower_copy(key)) == 0)
+			requests.push_back(dblp_citation_request(key));
+	if (requests.size() > 1)
+		url_transport->prefetch(requests, params.paralleldownloads);
+	std::vector<std::string> crossrefs;
+	for (auto& key : keys)
+	{
+		if (!sa::istarts_with(key, "dblp:"))
+			continue;
+		std::string bibentry;
+		auto it = dblpextracitations.find(sa::to_lower_copy(key));
+		if (it != dblpextracitations.end())
+			bibentry = it->second;
+		else
+			bibentry = extract_dblp_entries(url_transport->get_cached(dblp_citation_request(key)).second);
+		std::string crossref = bibentry_crossref(bibentry);
+		if (!crossref.empty() && !citation_known(crossref) && !negativecitations.contains(crossref)
+			&& speculativecitreferences.insert(sa::to_lower_copy(crossref)).second)
+			crossrefs.push_back(crossref);
+	}
+	if (!crossrefs.empty())
+		prefetch_citations(crossrefs);
+}
+
 #endif
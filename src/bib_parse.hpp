@@ -6,31 +6,578 @@
 #ifndef DBLPBIBTEX_BIB_PARSE_HPP
 #define DBLPBIBTEX_BIB_PARSE_HPP
 
+#include "core.hpp"
+#include "bib_scan.hpp"
+
 #include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
 
 #include <contrib/string_algo.hpp>
 namespace sa = string_algo;
 
+/*** bib-entry types ***/
+
+enum bib_command_t { bib_command_none, bib_command_entry, bib_command_string, bib_command_preamble, bib_command_comment };
+
+struct bib_type_name_t {
+	const char* name; /* lower case, at most bib_type_maxlength characters */
+	bib_command_t command;
+};
+
+const std::size_t bib_type_maxlength = 15;
+
+constexpr bib_type_name_t bib_builtin_types[] = {
+	{ "article", bib_command_entry }, { "book", bib_command_entry }, { "booklet", bib_command_entry },
+	{ "inbook", bib_command_entry }, { "incollection", bib_command_entry }, { "inproceedings", bib_command_entry },
+	{ "manual", bib_command_entry }, { "mastersthesis", bib_command_entry }, { "misc", bib_command_entry },
+	{ "phdthesis", bib_command_entry }, { "proceedings", bib_command_entry }, { "techreport", bib_command_entry },
+	{ "unpublished", bib_command_entry },
+	{ "string", bib_command_string }, { "preamble", bib_command_preamble }, { "comment", bib_command_comment }
+};
+constexpr std::size_t bib_builtin_count = sizeof(bib_builtin_types) / sizeof(bib_builtin_types[0]);
+
+// character i of a zero padded lower case type
+constexpr char bib_type_char(const char* lower, std::size_t i)
+{
+	return *lower == 0 ? 0 : i == 0 ? *lower : bib_type_char(lower + 1, i - 1);
+}
+// characters [i, i+n) of a zero padded lower case type as a little endian word
+constexpr std::uint64_t bib_type_word(const char* lower, std::size_t i, std::size_t n = 8)
+{
+	return n == 0 ? 0 : (std::uint64_t((unsigned char)(bib_type_char(lower, i + n - 1))) << (8 * (n - 1))) | bib_type_word(lower, i, n - 1);
+}
+std::uint64_t bib_type_word(const std::array<char, bib_type_maxlength + 1>& folded, std::size_t i)
+{
+	std::uint64_t word = 0;
+	for (std::size_t j = 8; j-- > 0; )
+		word = (word << 8) | (unsigned char)(folded[i + j]);
+	return word;
+}
+// hash of the two words of a folded fixed-width type, the multiplier makes it perfect for the builtin types
+constexpr unsigned bib_type_hash(std::uint64_t word0, std::uint64_t word1)
+{
+	return unsigned(((word0 ^ word1) * UINT64_C(0xca02135e92b1d3f3)) >> 59);
+}
+constexpr unsigned bib_type_hash(const char* lower)
+{
+	return bib_type_hash(bib_type_word(lower, 0), bib_type_word(lower, 8));
+}
+// index of the builtin type that hashes to slot, or bib_builtin_count
+constexpr unsigned char bib_builtin_slot(unsigned slot, std::size_t i = 0)
+{
+	return i == bib_builtin_count ? (unsigned char)(bib_builtin_count)
+		: bib_type_hash(bib_builtin_types[i].name) == slot ? (unsigned char)(i) : bib_builtin_slot(slot, i + 1);
+}
+constexpr bool bib_builtin_perfect(std::size_t i = 0, std::size_t j = 1)
+{
+	return i == bib_builtin_count ? true
+		: j == bib_builtin_count ? bib_builtin_perfect(i + 1, i + 2)
+		: bib_type_hash(bib_builtin_types[i].name) != bib_type_hash(bib_builtin_types[j].name) && bib_builtin_perfect(i, j + 1);
+}
+static_assert(bib_builtin_perfect(), "bib_type_hash has collisions among the builtin types");
+
+#define DBLPBIBTEX_BIB_SLOTS4(s) bib_builtin_slot(s), bib_builtin_slot(s + 1), bib_builtin_slot(s + 2), bib_builtin_slot(s + 3)
+constexpr unsigned char bib_builtin_slots[32] = {
+	DBLPBIBTEX_BIB_SLOTS4(0), DBLPBIBTEX_BIB_SLOTS4(4), DBLPBIBTEX_BIB_SLOTS4(8), DBLPBIBTEX_BIB_SLOTS4(12),
+	DBLPBIBTEX_BIB_SLOTS4(16), DBLPBIBTEX_BIB_SLOTS4(20), DBLPBIBTEX_BIB_SLOTS4(24), DBLPBIBTEX_BIB_SLOTS4(28)
+};
+#undef DBLPBIBTEX_BIB_SLOTS4
+
+// the folded builtin types as words, so a hashed type is verified with two comparisons
+static_assert(bib_builtin_count == 16, "bib_builtin_words lists 16 builtin types");
+#define DBLPBIBTEX_BIB_WORDS(i) { bib_type_word(bib_builtin_types[i].name, 0), bib_type_word(bib_builtin_types[i].name, 8) }
+constexpr std::uint64_t bib_builtin_words[bib_builtin_count][2] = {
+	DBLPBIBTEX_BIB_WORDS(0), DBLPBIBTEX_BIB_WORDS(1), DBLPBIBTEX_BIB_WORDS(2), DBLPBIBTEX_BIB_WORDS(3),
+	DBLPBIBTEX_BIB_WORDS(4), DBLPBIBTEX_BIB_WORDS(5), DBLPBIBTEX_BIB_WORDS(6), DBLPBIBTEX_BIB_WORDS(7),
+	DBLPBIBTEX_BIB_WORDS(8), DBLPBIBTEX_BIB_WORDS(9), DBLPBIBTEX_BIB_WORDS(10), DBLPBIBTEX_BIB_WORDS(11),
+	DBLPBIBTEX_BIB_WORDS(12), DBLPBIBTEX_BIB_WORDS(13), DBLPBIBTEX_BIB_WORDS(14), DBLPBIBTEX_BIB_WORDS(15)
+};
+#undef DBLPBIBTEX_BIB_WORDS
+
+std::vector< std::array<char, bib_type_maxlength + 1> > bib_extra_types; /* configured entry types, lower case and zero padded */
+
+// case-folds str[0..len) into a zero padded fixed-width buffer, fails for types that are too long
+bool bib_type_fold(const char* str, std::size_t len, std::array<char, bib_type_maxlength + 1>& folded)
+{
+	if (len == 0 || len > bib_type_maxlength)
+		return false;
+	folded.fill(0);
+	for (std::size_t i = 0; i < len; ++i)
+		folded[i] = char(std::tolower((unsigned char)(str[i])));
+	return true;
+}
+
+// recognizes the type of '@type{' without allocation
+bib_command_t bib_type_command(const char* str, std::size_t len)
+{
+	std::array<char, bib_type_maxlength + 1> folded;
+	if (!bib_type_fold(str, len, folded))
+		return bib_command_none;
+	const std::uint64_t word0 = bib_type_word(folded, 0), word1 = bib_type_word(folded, 8);
+	const std::size_t i = bib_builtin_slots[bib_type_hash(word0, word1)];
+	if (i < bib_builtin_count && word0 == bib_builtin_words[i][0] && word1 == bib_builtin_words[i][1])
+		return bib_builtin_types[i].command;
+	for (auto& type : bib_extra_types)
+		if (type == folded)
+			return bib_command_entry;
+	return bib_command_none;
+}
+
+// checks whether str[0..len) is a bib-entry type, case-insensitive
+bool is_bibentry_type(const char* str, std::size_t len)
+{
+	return bib_type_command(str, len) == bib_command_entry;
+}
+
+// adds a bib-entry type such as biblatex' 'online' or 'software', returns false if type is invalid
+bool add_bibentry_type(const std::string& type)
+{
+	std::array<char, bib_type_maxlength + 1> folded;
+	for (char c : type)
+		if (!std::isalpha((unsigned char)(c)))
+			return false;
+	if (!bib_type_fold(type.data(), type.size(), folded))
+		return false;
+	if (bib_type_command(type.data(), type.size()) == bib_command_none)
+		bib_extra_types.push_back(folded);
+	return bib_type_command(type.data(), type.size()) == bib_command_entry;
+}
+
 // finds starting position of the next bib-entry in bibstr
 std::string::size_type str_findbibentry(const std::string& bibstr, std::string::size_type offset = 0)
 {
-	const auto npos = std::string::npos;
-	while (true) {
-		auto pos = bibstr.find('@', offset);
-		if (pos == npos) return npos;
-		auto pos2 = bibstr.find_first_of("{(", pos);
-		if (pos2 == npos) return npos;
-		std::string cittype = sa::trim_copy(sa::to_lower_copy(bibstr.substr(pos + 1, pos2 - pos - 1)));
-		if (cittype == "article" || cittype == "book" || cittype == "booklet"
-			|| cittype == "inbook" || cittype == "incollection" || cittype == "inproceedings"
-			|| cittype == "manual" || cittype == "mastersthesis" || cittype == "misc"
-			|| cittype == "phdthesis" || cittype == "proceedings" || cittype == "techreport"
-			|| cittype == "unpublished")
-			return pos;
-		offset = pos + 1;
+	bib_scanner_t scan(bibstr.data(), bibstr.size());
+	for (auto pos = scan.find('@', offset); pos < bibstr.size(); )
+	{
+		// the type consists of letters, so it ends at the next structural character
+		auto end = scan.next(pos + 1);
+		if (end >= bibstr.size())
+			break;
+		if (bibstr[end] == '{' || bibstr[end] == '(')
+		{
+			auto begin = bibstr.find_first_not_of(" \t\r\n", pos + 1);
+			auto last = bibstr.find_last_not_of(" \t\r\n", end - 1);
+			if (begin < end && is_bibentry_type(bibstr.data() + begin, last + 1 - begin))
+				return pos;
+		}
+		pos = scan.find('@', end);
+	}
+	return std::string::npos;
+}
+
+// compares str case-insensitively with a lower case string, e.g. a field name with "crossref"
+bool bib_iequals(string_view_t str, const char* lower)
+{
+	for (char c : str)
+	{
+		if (*lower == 0 || std::tolower((unsigned char)(c)) != *lower)
+			return false;
+		++lower;
 	}
+	return *lower == 0;
 }
 
+// returns str without leading and trailing white space
+string_view_t bib_trim(string_view_t str)
+{
+	std::size_t begin = 0, end = str.size();
+	while (begin < end && std::isspace((unsigned char)(str[begin])))
+		++begin;
+	while (end > begin && std::isspace((unsigned char)(str[end - 1])))
+		--end;
+	return str.substr(begin, end - begin);
+}
+
+// position of a bib-entry found by bib_parser_t, all members are offsets into the parsed buffer
+// absent parts have begin == end
+struct bib_entry_pos_t {
+	std::size_t begin, end; /* from '@' until after the closing bracket */
+	std::size_t typebegin, typeend;
+	std::size_t keybegin, keyend;
+};
+
+enum bib_value_type_t {
+	bib_value_braced,  /* {text} */
+	bib_value_quoted,  /* "text" */
+	bib_value_number,  /* 2019 */
+	bib_value_macro,   /* name of a @string macro */
+	bib_value_concat   /* several of the above joined by '#' */
+};
+
+// value of a field or @preamble as passed to a visitor
+struct bib_value_t {
+	bib_value_type_t type;
+	string_view_t raw;  /* the value as written, including delimiters */
+	string_view_t text; /* the value without delimiters, with @string macros expanded and concatenations joined */
+};
+
+// base class of visitors of bib_parser_t, derived classes hide the functions they need
+// the views passed to a visitor are only valid during the call
+struct bib_visitor_t {
+	// start of bib-entry '@type{key, ...', return false to skip its fields
+	bool entry_begin(string_view_t /*type*/, string_view_t /*key*/) { return true; }
+	void entry_field(string_view_t /*name*/, const bib_value_t& /*value*/) {}
+	void entry_end(const bib_entry_pos_t& /*pos*/) {}
+	void preamble(const bib_value_t& /*value*/) {}
+};
+
+// single pass linear-time BibTeX parser
+// usage: bib_parser_t parser(bibstr); parser.parse(visitor);
+// @string macros defined earlier in the buffer and the standard month macros are expanded, @comment blocks are skipped, and commands of unknown type
+// are ignored like text outside entries
+// an entry that misses its closing bracket ends where a bib-entry starts at the beginning of a line
+// allocates only for @string definitions and to join concatenated values
+class bib_parser_t {
+public:
+	bib_parser_t(const char* data, std::size_t size)
+		: _data(data), _size(size), _scan(data, size)
+	{
+	}
+	explicit bib_parser_t(const std::string& str)
+		: bib_parser_t(str.data(), str.size())
+	{
+	}
+
+	template<typename Visitor>
+	void parse(Visitor& visitor)
+	{
+		std::size_t pos = 0;
+		while (pos < _size)
+		{
+			pos = _scan.find('@', pos);
+			if (pos >= _size)
+				break;
+			bib_entry_pos_t entry;
+			switch (_command_at(pos, entry))
+			{
+			case bib_command_entry:
+				pos = _parse_entry(entry, visitor);
+				break;
+			case bib_command_string:
+				pos = _parse_string(entry);
+				break;
+			case bib_command_preamble:
+				pos = _parse_preamble(entry, visitor);
+				break;
+			case bib_command_comment:
+				pos = _skip_group(entry.typeend);
+				break;
+			default:
+				++pos;
+			}
+		}
+	}
+
+	// returns the first position at or after pos where a line starts with a command such as '@article{', or the size
+	// every entry ends at such a position, so the buffer can be split there into parts that are parsed independently
+	std::size_t next_boundary(std::size_t pos) const
+	{
+		for (; pos < _size; ++pos)
+		{
+			const char* at = static_cast<const char*>(std::memchr(_data + pos, '@', _size - pos));
+			if (at == nullptr)
+				break;
+			pos = at - _data;
+			if (_recover_at(pos))
+				return pos;
+		}
+		return _size;
+	}
+
+	// macros used by a part of a buffer may be defined in an earlier part: the lower case names defined by @string,
+	// and the macros used without an earlier @string in the buffer, including months, which an earlier part may redefine
+	const std::vector<std::string>& strings_defined() const { return _stringsdefined; }
+	const std::vector<string_view_t>& macros_undefined() const { return _macrosundefined; }
+
+private:
+	static bool _is_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+	static bool _is_name(char c) { return std::isalnum((unsigned char)(c)) || c == '_' || c == '-' || c == ':' || c == '.' || c == '+' || c == '/'; }
+	string_view_t _view(std::size_t begin, std::size_t end) const { return string_view_t(_data + begin, end - begin); }
+
+	std::size_t _skip_space(std::size_t i) const
+	{
+		while (i < _size && _is_space(_data[i]))
+			++i;
+		return i;
+	}
+
+	// checks for '@type{' or '@type(' at pos, commands are short so this takes constant time
+	// on success entry.typeend is the position of the opening bracket
+	bib_command_t _command_at(std::size_t pos, bib_entry_pos_t& entry) const
+	{
+		std::size_t i = _skip_space(pos + 1);
+		entry.begin = pos;
+		entry.typebegin = i;
+		while (i < _size && i - entry.typebegin <= bib_type_maxlength && std::isalpha((unsigned char)(_data[i])))
+			++i;
+		string_view_t type = _view(entry.typebegin, i);
+		i = _skip_space(i);
+		if (i >= _size || (_data[i] != '{' && _data[i] != '(') || type.empty())
+			return bib_command_none;
+		entry.typeend = i;
+		return bib_type_command(type.data(), type.size());
+	}
+
+	// an '@' at the start of a line that starts a command, used to recover from a missing closing bracket
+	bool _recover_at(std::size_t i) const
+	{
+		bib_entry_pos_t entry;
+		return _data[i] == '@' && (i == 0 || _data[i - 1] == '\n') && _command_at(i, entry) != bib_command_none;
+	}
+
+	// returns the position of the unescaped closing character at brace depth 0 starting from i,
+	// or the position where parsing recovers, or _size
+	std::size_t _find_close(std::size_t i, char close) const
+	{
+		int depth = 0;
+		for (i = _scan.next(i); i < _size; i = _scan.next(i + 1))
+		{
+			const char c = _data[i];
+			if (c == '\\')
+				++i;
+			else if (c == close && depth == 0)
+				return i;
+			else if (c == '{')
+				++depth;
+			else if (c == '}')
+			{
+				if (depth > 0)
+					--depth;
+				else if (close == '"')
+					return i;
+			}
+			else if (c == '@' && _recover_at(i))
+				return i;
+		}
+		return _size;
+	}
+
+	// skips the bracketed group that opens at i, returns the position after it
+	std::size_t _skip_group(std::size_t i) const
+	{
+		const char close = _data[i] == '{' ? '}' : ')';
+		i = _find_close(i + 1, close);
+		return (i < _size && _data[i] == close) ? i + 1 : i;
+	}
+
+	// parses a value 'part # part # ...' starting at i, returns the position after it
+	std::size_t _parse_value(std::size_t i, bib_value_t& value)
+	{
+		const std::size_t begin = i = _skip_space(i);
+		std::size_t parts = 0;
+		while (i < _size)
+		{
+			string_view_t text;
+			const char c = _data[i];
+			if (c == '{' || c == '"')
+			{
+				std::size_t end = _find_close(i + 1, c == '{' ? '}' : '"');
+				text = _view(i + 1, end);
+				value.type = c == '{' ? bib_value_braced : bib_value_quoted;
+				i = (end < _size && _data[end] == (c == '{' ? '}' : '"')) ? end + 1 : end;
+			}
+			else if (std::isdigit((unsigned char)(c)))
+			{
+				std::size_t end = i;
+				while (end < _size && std::isdigit((unsigned char)(_data[end])))
+					++end;
+				text = _view(i, end);
+				value.type = bib_value_number;
+				i = end;
+			}
+			else if (_is_name(c))
+			{
+				std::size_t end = i;
+				while (end < _size && _is_name(_data[end]))
+					++end;
+				text = _view(i, end);
+				auto it = _find_string(text);
+				if (it != _strings.end() && _icompare(text, it->first) == 0)
+					text = string_view_t(it->second.data(), it->second.size());
+				else
+				{
+					_macrosundefined.push_back(text);
+					if (const char* month = _month(text))
+						text = string_view_t(month);
+				}
+				value.type = bib_value_macro;
+				i = end;
+			}
+			else
+				break;
+			if (parts++ == 0)
+				value.text = text;
+			else
+			{
+				if (parts == 2)
+					_concat.assign(value.text.data(), value.text.size());
+				_concat.append(text.data(), text.size());
+			}
+			std::size_t next = _skip_space(i);
+			if (next >= _size || _data[next] != '#')
+				break;
+			i = _skip_space(next + 1);
+		}
+		if (parts == 0)
+		{
+			value.type = bib_value_braced;
+			value.text = string_view_t();
+		}
+		else if (parts > 1)
+		{
+			value.type = bib_value_concat;
+			value.text = string_view_t(_concat.data(), _concat.size());
+		}
+		value.raw = _view(begin, i);
+		return i;
+	}
+
+	template<typename Visitor>
+	std::size_t _parse_entry(bib_entry_pos_t& entry, Visitor& visitor)
+	{
+		const char close = _data[entry.typeend] == '{' ? '}' : ')';
+		std::size_t i = entry.typeend + 1;
+		entry.typeend = entry.typebegin;
+		while (std::isalpha((unsigned char)(_data[entry.typeend])))
+			++entry.typeend;
+
+		entry.keybegin = i = _skip_space(i);
+		while (i < _size && _data[i] != ',' && _data[i] != '}' && _data[i] != ')' && _data[i] != '\n')
+			++i;
+		entry.keyend = i;
+		while (entry.keyend > entry.keybegin && _is_space(_data[entry.keyend - 1]))
+			--entry.keyend;
+		const bool visit = visitor.entry_begin(_view(entry.typebegin, entry.typeend), _view(entry.keybegin, entry.keyend));
+
+		bib_value_t value;
+		while (true)
+		{
+			i = _skip_space(i);
+			if (i >= _size)
+				break;
+			const char c = _data[i];
+			if (c == close)
+			{
+				++i;
+				break;
+			}
+			if (c == '@' && _recover_at(i))
+				break;
+			if (!_is_name(c))
+			{
+				// skip junk such as separating commas and stray characters
+				++i;
+				continue;
+			}
+			std::size_t namebegin = i;
+			while (i < _size && _is_name(_data[i]))
+				++i;
+			std::size_t nameend = i;
+			i = _skip_space(i);
+			if (i >= _size || _data[i] != '=')
+				continue;
+			i = _parse_value(i + 1, value);
+			if (visit)
+				visitor.entry_field(_view(namebegin, nameend), value);
+		}
+		entry.end = i;
+		visitor.entry_end(entry);
+		return i;
+	}
+
+	// '@string{name = value}'
+	std::size_t _parse_string(bib_entry_pos_t& entry)
+	{
+		std::size_t i = _skip_space(entry.typeend + 1), namebegin = i;
+		while (i < _size && _is_name(_data[i]))
+			++i;
+		std::size_t nameend = i;
+		i = _skip_space(i);
+		if (nameend > namebegin && i < _size && _data[i] == '=')
+		{
+			bib_value_t value;
+			i = _parse_value(i + 1, value);
+			string_view_t name = _view(namebegin, nameend);
+			std::string text(value.text.data(), value.text.size()); /* may refer to another macro */
+			auto it = _find_string(name);
+			if (it == _strings.end() || _icompare(name, it->first) != 0)
+			{
+				std::string lower(name.data(), name.size());
+				for (auto& c : lower)
+					c = char(std::tolower((unsigned char)(c)));
+				it = _strings.insert(it, std::make_pair(lower, std::string()));
+			}
+			it->second.swap(text);
+			_stringsdefined.push_back(it->first);
+		}
+		return _skip_group_rest(i, _data[entry.typeend]);
+	}
+
+	// '@preamble{value}'
+	template<typename Visitor>
+	std::size_t _parse_preamble(bib_entry_pos_t& entry, Visitor& visitor)
+	{
+		bib_value_t value;
+		std::size_t i = _parse_value(entry.typeend + 1, value);
+		visitor.preamble(value);
+		return _skip_group_rest(i, _data[entry.typeend]);
+	}
+
+	// skips the remainder of a group opened by open until after its closing bracket
+	std::size_t _skip_group_rest(std::size_t i, char open) const
+	{
+		const char close = open == '{' ? '}' : ')';
+		i = _find_close(i, close);
+		return (i < _size && _data[i] == close) ? i + 1 : i;
+	}
+
+	// case-insensitive comparison of a macro name with a lower case name
+	static int _icompare(string_view_t name, const std::string& lower)
+	{
+		for (std::size_t i = 0; i < name.size() && i < lower.size(); ++i)
+		{
+			int c = std::tolower((unsigned char)(name[i]));
+			if (c != (unsigned char)(lower[i]))
+				return c < (unsigned char)(lower[i]) ? -1 : 1;
+		}
+		return name.size() == lower.size() ? 0 : (name.size() < lower.size() ? -1 : 1);
+	}
+	// the predefined month macros of BibTeX
+	static const char* _month(string_view_t name)
+	{
+		static const char* const months[12][2] = {
+			{ "jan", "January" }, { "feb", "February" }, { "mar", "March" }, { "apr", "April" },
+			{ "may", "May" }, { "jun", "June" }, { "jul", "July" }, { "aug", "August" },
+			{ "sep", "September" }, { "oct", "October" }, { "nov", "November" }, { "dec", "December" }
+		};
+		if (name.size() == 3)
+			for (auto& month : months)
+				if (bib_iequals(name, month[0]))
+					return month[1];
+		return nullptr;
+	}
+	std::vector< std::pair<std::string, std::string> >::iterator _find_string(string_view_t name)
+	{
+		return std::lower_bound(_strings.begin(), _strings.end(), name,
+			[](const std::pair<std::string, std::string>& macro, string_view_t name) { return _icompare(name, macro.first) > 0; });
+	}
+
+	const char* _data;
+	std::size_t _size;
+	mutable bib_scanner_t _scan; /* finds the structural characters */
+	std::vector< std::pair<std::string, std::string> > _strings; /* @string macros sorted by lower case name */
+	std::string _concat; /* joined text of the last concatenated value */
+	std::vector<std::string> _stringsdefined; /* lower case names defined by @string */
+	std::vector<string_view_t> _macrosundefined; /* macros used without an earlier @string */
+};
+
 // extracts first complete bib-entry from str starting at pos
 std::string extract_bibentry(const std::string& str, std::string::size_type pos)
 {
@@ -38,27 +585,22 @@ std::string extract_bibentry(const std::string& str, std::string::size_type pos)
 	if (pos >= str.size() || str[pos] != '@')
 		return std::string();
 	// find first opening bracket
-	auto posbr = str.find_first_of("{", pos+1);
-	if (posbr > str.size())
+	bib_scanner_t scan(str.data(), str.size());
+	auto posbr = scan.find('{', pos + 1);
+	if (posbr >= str.size())
 		return std::string();
 	// find position of closing bracket
 	int open_brackets = 1;
-	posbr = str.find_first_of("{}", posbr+1);
-	while (posbr < str.size())
-	{
-		int countslashes = 0;
-		while (str[posbr - countslashes - 1] == '\\')
-			++countslashes;
-		// if bracket is not escaped then count it
-		if ((countslashes & 1) == 0)
-		{
-			if (str[posbr] == '{')
-				++open_brackets;
-			else if (str[posbr] == '}')
-				if (--open_brackets == 0)
-					break;
-		}
-		posbr = str.find_first_of("{}", posbr + 1);
+	for (posbr = scan.next(posbr + 1); posbr < str.size(); posbr = scan.next(posbr + 1))
+	{
+		// escaped brackets are not counted
+		if (str[posbr] == '\\')
+			++posbr;
+		else if (str[posbr] == '{')
+			++open_brackets;
+		else if (str[posbr] == '}')
+			if (--open_brackets == 0)
+				break;
 	}
 	if (open_brackets == 0)
 		return str.substr(pos, posbr-pos+1);
@@ -79,4 +621,163 @@ std::string extract_bibentry(const std::string& str)
 	return std::string();
 }
 
+// index of the bib-entries in the parsed bib files, the file contents are kept in one file view per file
+// entries are stored as a structure of arrays of offsets and lengths into these buffers,
+// so adding and looking up entries allocates no per-entry strings
+// usage: auto& buffer = bibindex.add_buffer(std::move(view)); parse buffer and bibindex.add(pos) for each entry
+// keys are case-insensitive
+class bib_index_t {
+public:
+	void clear()
+	{
+		_buffers.clear();
+		_keyhashes.clear(); _buffer.clear(); _offsets.clear(); _lengths.clear(); _keyoffsets.clear(); _keylengths.clear();
+		_slots.clear();
+	}
+
+	// takes ownership of the content of a bib file, entries added next refer to it
+	const file_view_t& add_buffer(file_view_t&& content)
+	{
+		_buffers.emplace_back(std::move(content));
+		return _buffers.back();
+	}
+
+	void add(const bib_entry_pos_t& entry)
+	{
+		if (entry.keyend == entry.keybegin || _buffers.empty())
+			return;
+		const file_view_t& buffer = _buffers.back();
+		_keyhashes.push_back(_key_hash(string_view_t(buffer.data() + entry.keybegin, entry.keyend - entry.keybegin)));
+		_buffer.push_back(std::uint32_t(_buffers.size() - 1));
+		_offsets.push_back(entry.begin);
+		_lengths.push_back(entry.end - entry.begin);
+		_keyoffsets.push_back(entry.keybegin);
+		_keylengths.push_back(std::uint32_t(entry.keyend - entry.keybegin));
+		if (2 * _keyhashes.size() > _slots.size())
+			_rehash();
+		else
+			_insert_slot(_keyhashes.size() - 1);
+	}
+
+	std::size_t size() const { return _keyhashes.size(); }
+	string_view_t key(std::size_t i) const { return string_view_t(_buffers[_buffer[i]].data() + _keyoffsets[i], _keylengths[i]); }
+	string_view_t entry(std::size_t i) const { return string_view_t(_buffers[_buffer[i]].data() + _offsets[i], _lengths[i]); }
+
+	bool contains(string_view_t key) const
+	{
+		if (_slots.empty())
+			return false;
+		const std::uint64_t h = _key_hash(key);
+		for (std::size_t slot = std::size_t(h) & (_slots.size() - 1); _slots[slot] != 0; slot = (slot + 1) & (_slots.size() - 1))
+		{
+			const std::size_t i = _slots[slot] - 1;
+			if (_keyhashes[i] == h && _iequals(this->key(i), key))
+				return true;
+		}
+		return false;
+	}
+	bool contains(const std::string& key) const { return contains(string_view_t(key.data(), key.size())); }
+
+private:
+	static std::uint64_t _key_hash(string_view_t key)
+	{
+		// 64-bit FNV-1a of the lower case key
+		std::uint64_t h = 0xcbf29ce484222325ULL;
+		for (char c : key)
+		{
+			h ^= (unsigned char)(std::tolower((unsigned char)(c)));
+			h *= 0x100000001b3ULL;
+		}
+		return h;
+	}
+	static bool _iequals(string_view_t a, string_view_t b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (std::size_t i = 0; i < a.size(); ++i)
+			if (std::tolower((unsigned char)(a[i])) != std::tolower((unsigned char)(b[i])))
+				return false;
+		return true;
+	}
+
+	// open addressing hash table of entry index + 1, at most half full
+	void _insert_slot(std::size_t i)
+	{
+		std::size_t slot = std::size_t(_keyhashes[i]) & (_slots.size() - 1);
+		while (_slots[slot] != 0)
+			slot = (slot + 1) & (_slots.size() - 1);
+		_slots[slot] = std::uint32_t(i + 1);
+	}
+	void _rehash()
+	{
+		_slots.assign(_slots.empty() ? 1024 : 2 * _slots.size(), 0);
+		for (std::size_t i = 0; i < _keyhashes.size(); ++i)
+			_insert_slot(i);
+	}
+
+	std::deque<file_view_t> _buffers; /* content of each parsed bib file */
+	std::vector<std::uint64_t> _keyhashes; /* per entry: hash of the lower case key */
+	std::vector<std::uint32_t> _buffer; /* per entry: index in _buffers */
+	std::vector<std::size_t> _offsets, _lengths; /* per entry: position of the entry in its buffer */
+	std::vector<std::size_t> _keyoffsets; /* per entry: position of the key in its buffer */
+	std::vector<std::uint32_t> _keylengths;
+	std::vector<std::uint32_t> _slots;
+};
+
+bib_index_t bibindex; /* all entries parsed from bibfiles */
+
+// key and crossref of the first bib-entry parsed
+struct bibentry_first_visitor_t
+	: public bib_visitor_t
+{
+	bibentry_first_visitor_t()
+		: entries(0)
+	{
+	}
+	bool entry_begin(string_view_t /*type*/, string_view_t entrykey)
+	{
+		if (entries++ != 0)
+			return false;
+		key.assign(entrykey.data(), entrykey.size());
+		return true;
+	}
+	void entry_field(string_view_t name, const bib_value_t& value)
+	{
+		if (crossref.empty() && bib_iequals(name, "crossref"))
+		{
+			string_view_t text = bib_trim(value.text);
+			crossref.assign(text.data(), text.size());
+		}
+	}
+
+	unsigned entries;
+	std::string key, crossref;
+};
+
+// positions of all parsed bib-entries
+struct bib_entries_visitor_t
+	: public bib_visitor_t
+{
+	bool entry_begin(string_view_t /*type*/, string_view_t /*key*/) { return false; }
+	void entry_end(const bib_entry_pos_t& pos) { entries.push_back(pos); }
+
+	std::vector<bib_entry_pos_t> entries;
+};
+
+// returns the key of bib-entry '@type{key, ...}', or an empty string
+std::string bibentry_key(const std::string& bibentry)
+{
+	bibentry_first_visitor_t visitor;
+	bib_parser_t(bibentry).parse(visitor);
+	return visitor.key;
+}
+
+// returns the value of the crossref field of bib-entry, or an empty string
+std::string bibentry_crossref(const std::string& bibentry)
+{
+	bibentry_first_visitor_t visitor;
+	bib_parser_t(bibentry).parse(visitor);
+	return visitor.crossref;
+}
+
 #endif
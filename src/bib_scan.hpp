@@ -0,0 +1,193 @@
+//          Copyright Marc Stevens 2010 - 2019.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBLPBIBTEX_BIB_SCAN_HPP
+#define DBLPBIBTEX_BIB_SCAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) /* SSE2 is part of x86-64 */
+#define DBLPBIBTEX_BIB_SCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/*** structural character scanner ***/
+
+// the structural characters of bib files are: @ { } ( ) \ " ,
+// a kernel classifies a block of 64 bytes into a bitmask with bit i set when p[i] is structural
+
+inline bool bib_is_structural(char c)
+{
+	return c == '@' || c == '{' || c == '}' || c == '(' || c == ')' || c == '\\' || c == '"' || c == ',';
+}
+
+std::uint64_t bib_structural_mask_scalar(const char* p, std::size_t len = 64)
+{
+	std::uint64_t mask = 0;
+	for (std::size_t i = 0; i < len; ++i)
+		if (bib_is_structural(p[i]))
+			mask |= std::uint64_t(1) << i;
+	return mask;
+}
+
+#ifdef DBLPBIBTEX_BIB_SCAN_X86
+std::uint64_t bib_structural_mask_sse2(const char* p, std::size_t = 64)
+{
+	std::uint64_t mask = 0;
+	for (unsigned k = 0; k < 4; ++k)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * k));
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('@')), _mm_cmpeq_epi8(v, _mm_set1_epi8('{'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('}')), _mm_cmpeq_epi8(v, _mm_set1_epi8('('))));
+		m = _mm_or_si128(m, _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(')')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8(',')))));
+		mask |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(m))) << (16 * k);
+	}
+	return mask;
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+std::uint64_t bib_structural_mask_avx2(const char* p, std::size_t = 64)
+{
+	std::uint64_t mask = 0;
+	for (unsigned k = 0; k < 2; ++k)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * k));
+		__m256i m = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('@')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('{'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('('))));
+		m = _mm256_or_si256(m, _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')))));
+		mask |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(m))) << (32 * k);
+	}
+	return mask;
+}
+
+bool bib_cpu_has_avx2()
+{
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	// the OS must save the YMM registers
+	if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return false;
+#endif
+}
+#endif // DBLPBIBTEX_BIB_SCAN_X86
+
+typedef std::uint64_t (*bib_structural_kernel_t)(const char*, std::size_t);
+
+// selects the fastest kernel that the CPU supports
+bib_structural_kernel_t bib_structural_kernel_select()
+{
+#ifdef DBLPBIBTEX_BIB_SCAN_X86
+	if (bib_cpu_has_avx2())
+		return &bib_structural_mask_avx2;
+	return &bib_structural_mask_sse2;
+#else
+	return &bib_structural_mask_scalar;
+#endif
+}
+
+bib_structural_kernel_t bib_structural_kernel = bib_structural_kernel_select();
+
+inline unsigned bib_ctz64(std::uint64_t x)
+{
+#if defined(__GNUC__)
+	return unsigned(__builtin_ctzll(x));
+#elif defined(_MSC_VER) && defined(_M_X64)
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return unsigned(i);
+#else
+	unsigned i = 0;
+	while ((x & 1) == 0)
+	{
+		x >>= 1;
+		++i;
+	}
+	return i;
+#endif
+}
+
+// usage: bib_scanner_t scan(data, size); for (pos = scan.next(pos); pos < size; pos = scan.next(pos + 1)) { data[pos] is structural }
+// the bitmask of the current 64 byte block is kept, so scanning forward classifies every byte once
+class bib_scanner_t {
+public:
+	bib_scanner_t(const char* data, std::size_t size)
+		: _data(data), _size(size), _block(0), _blockend(0), _mask(0)
+	{
+	}
+
+	// returns the position of the first structural character at or after pos, or size
+	std::size_t next(std::size_t pos)
+	{
+		if (pos < _block || pos >= _blockend)
+		{
+			if (pos >= _size)
+				return _size;
+			_load(pos);
+		}
+		std::uint64_t mask = _mask >> (pos - _block);
+		while (mask == 0)
+		{
+			if (_blockend >= _size)
+				return _size;
+			_load(_blockend);
+			mask = _mask;
+		}
+		return (pos < _block ? _block : pos) + bib_ctz64(mask);
+	}
+
+	// returns the position of the first c at or after pos, or size, where c must be structural
+	std::size_t find(char c, std::size_t pos)
+	{
+		for (pos = next(pos); pos < _size && _data[pos] != c; pos = next(pos + 1))
+			;
+		return pos;
+	}
+
+private:
+	void _load(std::size_t pos)
+	{
+		_block = pos;
+		if (_size - pos >= 64)
+		{
+			_blockend = pos + 64;
+			_mask = bib_structural_kernel(_data + pos, 64);
+		}
+		else
+		{
+			_blockend = _size;
+			_mask = bib_structural_mask_scalar(_data + pos, _size - pos);
+		}
+	}
+
+	const char* _data;
+	std::size_t _size;
+	std::size_t _block, _blockend; /* current block */
+	std::uint64_t _mask; /* structural characters of the current block */
+};
+
+#endif // DBLPBIBTEX_BIB_SCAN_HPP
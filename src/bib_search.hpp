@@ -7,6 +7,11 @@
 #define DBLPBIBTEX_BIB_SEARCH_HPP
 
 #include "core.hpp"
+#include "transport.hpp"
+#include "bib_parse.hpp"
+
+#include <algorithm>
+#include <cctype>
 
 #include <contrib/string_algo.hpp>
 namespace sa = string_algo;
@@ -19,21 +24,26 @@ bool search_citation_bib(const std::string& citkey)
 	for (auto& keyword : keywords)
 		sa::trim(keyword);
 
-	std::vector<std::string> cits;
-	for (auto& cit : tosearchcitations_complete)
+	// matching keys in sorted order
+	std::set<std::string> matches;
+	for (std::size_t i = 0; i < bibindex.size(); ++i)
 	{
+		string_view_t entry = bibindex.entry(i);
 		bool ok = true;
 		for (auto& keyword : keywords)
 		{
-			if (cit.second.find(keyword) == std::string::npos)
+			auto it = std::search(entry.begin(), entry.end(), keyword.begin(), keyword.end(),
+				[](char c, char k) { return std::tolower((unsigned char)(c)) == k; });
+			if (it == entry.end())
 			{
 				ok = false;
 				break;
 			}
 		}
 		if (ok)
-			cits.push_back(cit.first);
+			matches.insert(std::string(bibindex.key(i)));
 	}
+	std::vector<std::string> cits(matches.begin(), matches.end());
 	if (cits.empty())
 		return false;
 	if (cits.size() > 5)
@@ -50,7 +60,7 @@ bool search_citation_dblp(const std::string& citkey)
 		std::cout << "Search phrase too short <5 chars: '" << searchphrase << "'" << std::endl;
 		return false;
 	}
-	auto p_header_body = url_get("https://dblp.org/search?q=" + searchphrase);
+	auto p_header_body = url_transport->get(params.dblpmirrors.front() + "/search?q=" + searchphrase);
 	auto& html = p_header_body.second;
 
 	html.erase(html.begin(), sa::ifind(html,"<body"));
@@ -95,7 +105,7 @@ bool search_citation_cryptoeprint(const std::string& citkey)
 		+ searchstr + "\r\n"
 		+ "-----------------------------41184676334\r\n"
 		;*/
-	auto p_hdr_html = url_get("https://eprint.iacr.org/eprint-bin/search.pl", postdata);
+	auto p_hdr_html = url_transport->get("https://eprint.iacr.org/eprint-bin/search.pl", postdata);
 	auto& html = p_hdr_html.second;
 
 	html.erase(html.begin(), sa::ifind(html,"<body"));
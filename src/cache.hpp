@@ -0,0 +1,288 @@
+//          Copyright Marc Stevens 2010 - 2019.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBLPBIBTEX_CACHE_HPP
+#define DBLPBIBTEX_CACHE_HPP
+
+#include "core.hpp"
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <sstream>
+#include <iomanip>
+
+/*** persistent on-disk cache ***/
+
+// 64-bit FNV-1a hash, used to derive cache file names
+std::uint64_t fnv1a_hash(const char* str, std::size_t len)
+{
+	std::uint64_t h = 0xcbf29ce484222325ULL;
+	for (std::size_t i = 0; i < len; ++i)
+	{
+		h ^= (unsigned char)(str[i]);
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+std::uint64_t fnv1a_hash(const std::string& str)
+{
+	return fnv1a_hash(str.data(), str.size());
+}
+std::string hex_hash(const std::string& str)
+{
+	std::ostringstream oss;
+	oss << std::hex << std::setw(16) << std::setfill('0') << fnv1a_hash(str);
+	return oss.str();
+}
+
+// write content to filename via a temporary file and a rename,
+// so that concurrent runs never read a partially written cache file
+bool atomic_write_file(const std::string& filename, const std::string& content)
+{
+	std::string tmpfilename = filename + "." + hex_hash(filename + std::to_string(std::time(nullptr)) + std::to_string(std::clock())) + ".tmp";
+	{
+		std::ofstream ofs(tmpfilename.c_str(), std::ios::binary);
+		if (!ofs)
+			return false;
+		ofs << content;
+		if (!ofs)
+			return false;
+	}
+	try {
+		fs::rename(tmpfilename, filename);
+	} catch (...) {
+		try { fs::remove(tmpfilename); } catch (...) {}
+		return false;
+	}
+	return true;
+}
+
+// modification time of a file in an unspecified unit, or 0 when it cannot be determined
+// std::filesystem returns a time point, boost::filesystem a time_t
+template<typename TimePoint>
+long long file_time_count(const TimePoint& t) { return (long long)t.time_since_epoch().count(); }
+inline long long file_time_count(std::time_t t) { return (long long)t; }
+long long file_mtime(const std::string& filename)
+{
+	try {
+		return file_time_count(fs::last_write_time(filename));
+	} catch (...) {
+		return 0;
+	}
+}
+
+// default cache directory: $XDG_CACHE_HOME/dblpbibtex, $HOME/.cache/dblpbibtex or %LOCALAPPDATA%/dblpbibtex
+std::string default_cache_dir()
+{
+	std::string dir = getenvvar("XDG_CACHE_HOME");
+	if (dir.empty() && !getenvvar("HOME").empty())
+		dir = (fs::path(getenvvar("HOME")) / ".cache").string();
+	if (dir.empty())
+		dir = getenvvar("LOCALAPPDATA");
+	if (dir.empty())
+		return std::string();
+	return (fs::path(dir) / "dblpbibtex").string();
+}
+
+// cached HTTP response body with its validators
+struct http_cache_entry_t {
+	http_cache_entry_t()
+		: time(0), partial(false)
+	{
+	}
+
+	std::string url;
+	std::string etag;
+	std::string lastmodified;
+	std::time_t time; /* when this response was last retrieved or revalidated */
+	bool partial; /* body ends where the transfer was stopped once the requester had what it needed */
+	std::string body;
+};
+
+// usage: http_cache.open(dir, ttl) enables caching, cache entries younger than ttl seconds are fresh
+// entries are stored in files named by the hash of their url, so the dblpformat parameter in DBLP urls is part of the key
+class http_cache_t {
+public:
+	http_cache_t()
+		: _ttl(0)
+	{
+	}
+
+	bool open(const std::string& dir, std::time_t ttl)
+	{
+		_dir.clear();
+		if (dir.empty())
+			return false;
+		try {
+			fs::create_directories(fs::path(dir) / "http");
+		} catch (std::exception& e) {
+			std::cerr << "Cannot create cache directory '" << dir << "': " << e.what() << std::endl;
+			return false;
+		}
+		_dir = dir;
+		_ttl = ttl;
+		return true;
+	}
+	bool enabled() const { return !_dir.empty(); }
+	const std::string& dir() const { return _dir; }
+
+	bool is_fresh(const http_cache_entry_t& entry) const
+	{
+		return std::time(nullptr) - entry.time < _ttl;
+	}
+
+	bool load(const std::string& url, http_cache_entry_t& entry) const
+	{
+		if (!enabled())
+			return false;
+		std::string content;
+		if (!read_file(_filename(url), content))
+			return false;
+		// header lines 'name: value' until an empty line, followed by the body
+		std::string::size_type pos = 0;
+		entry = http_cache_entry_t();
+		while (pos < content.size())
+		{
+			std::string::size_type eol = content.find('\n', pos);
+			if (eol == std::string::npos)
+				return false;
+			std::string line = content.substr(pos, eol - pos);
+			pos = eol + 1;
+			if (line.empty())
+				break;
+			std::string::size_type colon = line.find(": ");
+			if (colon == std::string::npos)
+				return false;
+			std::string name = line.substr(0, colon), value = line.substr(colon + 2);
+			if (name == "url")
+				entry.url = value;
+			else if (name == "time")
+			{
+				// a corrupt entry is a cache miss, it is replaced by the next download
+				try {
+					entry.time = std::time_t(std::stoll(value));
+				} catch (...) {
+					return false;
+				}
+			}
+			else if (name == "etag")
+				entry.etag = value;
+			else if (name == "last-modified")
+				entry.lastmodified = value;
+			else if (name == "partial")
+				entry.partial = value == "1";
+		}
+		// protect against hash collisions
+		if (entry.url != url)
+			return false;
+		entry.body = content.substr(pos);
+		return true;
+	}
+
+	bool store(const http_cache_entry_t& entry) const
+	{
+		if (!enabled())
+			return false;
+		std::string content = "url: " + entry.url + "\n"
+			+ "time: " + std::to_string((long long)entry.time) + "\n";
+		if (!entry.etag.empty())
+			content += "etag: " + entry.etag + "\n";
+		if (!entry.lastmodified.empty())
+			content += "last-modified: " + entry.lastmodified + "\n";
+		if (entry.partial)
+			content += "partial: 1\n";
+		content += "\n" + entry.body;
+		return atomic_write_file(_filename(entry.url), content);
+	}
+
+private:
+	std::string _filename(const std::string& url) const
+	{
+		return (fs::path(_dir) / "http" / (hex_hash(url) + ".cache")).string();
+	}
+
+	std::string _dir;
+	std::time_t _ttl;
+};
+
+// usage: negative_cache.open(dir, ttl) loads keys that could not be resolved in previous runs,
+// a key is skipped until ttl seconds after it failed, changes are written by negative_cache.save()
+class negative_cache_t {
+public:
+	negative_cache_t()
+		: _ttl(0), _changed(false)
+	{
+	}
+
+	bool open(const std::string& dir, std::time_t ttl)
+	{
+		_keys.clear();
+		_filename.clear();
+		_ttl = ttl;
+		if (dir.empty() || ttl == 0)
+			return false;
+		try {
+			fs::create_directories(dir);
+		} catch (std::exception& e) {
+			std::cerr << "Cannot create cache directory '" << dir << "': " << e.what() << std::endl;
+			return false;
+		}
+		_filename = (fs::path(dir) / "negative.txt").string();
+		std::string content;
+		read_file(_filename, content);
+		// lines 'time key'
+		for (auto& line : sa::split(content, '\n'))
+		{
+			std::string::size_type space = line.find(' ');
+			if (space == std::string::npos)
+				continue;
+			try {
+				_keys[line.substr(space + 1)] = std::time_t(std::stoll(line.substr(0, space)));
+			} catch (...) {
+			}
+		}
+		return true;
+	}
+	bool enabled() const { return !_filename.empty(); }
+
+	bool contains(const std::string& key) const
+	{
+		auto it = _keys.find(sa::to_lower_copy(key));
+		return it != _keys.end() && std::time(nullptr) - it->second < _ttl;
+	}
+	void insert(const std::string& key)
+	{
+		if (!enabled())
+			return;
+		_keys[sa::to_lower_copy(key)] = std::time(nullptr);
+		_changed = true;
+	}
+	void clear()
+	{
+		_changed = _changed || !_keys.empty();
+		_keys.clear();
+	}
+
+	bool save()
+	{
+		if (!enabled() || !_changed)
+			return true;
+		std::string content;
+		for (auto& kt : _keys)
+			if (std::time(nullptr) - kt.second < _ttl)
+				content += std::to_string((long long)kt.second) + " " + kt.first + "\n";
+		_changed = false;
+		return atomic_write_file(_filename, content);
+	}
+
+private:
+	std::map<std::string, std::time_t> _keys; /* lower case key => time of failure */
+	std::string _filename;
+	std::time_t _ttl;
+	bool _changed;
+};
+
+#endif // DBLPBIBTEX_CACHE_HPP
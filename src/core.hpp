@@ -24,6 +24,19 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include <contrib/string_algo.hpp>
 namespace sa = string_algo;
@@ -35,6 +48,15 @@ namespace sa = string_algo;
 #include DBLPBIBTEX_CXX17FILESYSTEMHEADER           /* <filesystem> / <experimental/filesystem> */
 namespace fs = DBLPBIBTEX_CXX17FILESYSTEMNAMESPACE; /* std::filesystem / std::experimental::filesystem; */
 
+#if !defined(HAVE_CONFIG_H) || defined(DBLPBIBTEX_HAVE_CXX17)
+#include <string_view>
+typedef std::string_view string_view_t;
+#else
+// boost::string_view requires Boost 1.61, which configure checks for
+#include <boost/utility/string_view.hpp>
+typedef boost::string_view string_view_t;
+#endif
+
 /*** global variables ***/
 std::string bibtexargs; /* from bibtex command line */
 std::string auxfile; /* from bibtex command line */
@@ -43,8 +65,6 @@ std::vector<std::string> bibfiles; /* from auxfile */
 std::set<std::string> citations; /* from auxfile */
 std::vector<std::string> citreferences; /* parsed from citations from bibfiles or downloaded */
 
-std::set<std::string> havecitations; /* parsed from bibfiles: ALL LOWER CASE !!! */
-std::map<std::string, std::string> tosearchcitations_complete; /* parsed from to search bibfiles */
 std::set<std::string> havecitreferences; /* parsed from bibfiles */
 std::string mainbibfile; /* first bibfile encountered will be used to insert downloaded citations and references */
 std::string mainbibfilecontent; /* content from main bibfile to insert downloaded citations and references */
@@ -63,7 +83,24 @@ struct parameters_type {
 	bool nodownload;
 	bool nodblp;
 	int dblpformat;
+	std::vector<std::string> dblpmirrors; /* DBLP base urls, the first is the primary server */
+	unsigned dblpbulkmin; /* minimum number of missing keys of a DBLP venue to download its export, 0 disables */
 	bool nocryptoeprint;
+	std::vector<std::string> bibentrytypes; /* additional bib-entry types, e.g. biblatex types */
+	unsigned parsethreads; /* number of threads parsing bib files, 0 for all cores */
+	bool noparsecache;
+	unsigned paralleldownloads; /* maximum number of concurrent downloads */
+	unsigned connecttimeout; /* in seconds */
+	double maxrequestrate; /* maximum number of requests per second per host */
+	std::string cachedir; /* directory for the on-disk download cache */
+	bool nocache;
+	unsigned cachettl; /* in days, after which cached downloads are revalidated */
+	unsigned negativecachettl; /* in hours, during which unresolvable keys are not retried */
+	bool clearnegativecache;
+	std::string transport; /* 'live', 'record' or 'replay' */
+	std::string fixturefile; /* request/response pairs for transport record and replay */
+	unsigned replaylatency; /* in milliseconds, per replayed response */
+	std::vector<std::string> replayhostlatencies; /* 'host=milliseconds', replaces replaylatency for host */
 	bool enablesearch; /* can only be enabled inside tex file with \nocite{dblpbibtex:enablesearch} */
 	bool cleanupmainbib; /* can only be enable inside tex file with \nocite{dblpbibtex:cleanupmainbib} */
 };
@@ -85,6 +122,18 @@ std::string dblpformat_name(int dblpformat)
 }
 std::string read_istream(std::istream& is) {
 	std::string tmp;
+	// read the remainder at once when its size is known
+	std::streamoff pos = is.tellg();
+	if (pos >= 0 && is.seekg(0, std::ios::end)) {
+		std::streamoff size = std::streamoff(is.tellg()) - pos;
+		is.seekg(pos);
+		if (size > 0 && is) {
+			tmp.resize(std::size_t(size));
+			is.read(&tmp[0], size);
+			tmp.resize(std::size_t(is.gcount()));
+		}
+	}
+	is.clear(is.rdstate() & ~std::ios::failbit);
 	char buffer[1024];
 	while (is) {
 		is.read(buffer, 1024);
@@ -105,6 +154,99 @@ bool read_file(const std::string& path, std::string& content)
 	return true;
 }
 
+// read-only view of the content of a file, memory mapped where possible
+// otherwise, on Windows, and when opened with map = false, the file is read into memory with read_istream
+// files that are rewritten in place, e.g., by safe_write_file, are read: a mapped view of a file that another run truncates
+// crashes with SIGBUS
+class file_view_t {
+public:
+	file_view_t()
+		: _data(nullptr), _size(0), _mapped(false)
+	{
+	}
+	file_view_t(file_view_t&& other)
+		: file_view_t()
+	{
+		*this = std::move(other);
+	}
+	file_view_t& operator=(file_view_t&& other)
+	{
+		if (this == &other)
+			return *this;
+		close();
+		_content = std::move(other._content);
+		_data = other._mapped ? other._data : _content.data();
+		_size = other._size;
+		_mapped = other._mapped;
+		other._data = nullptr;
+		other._size = 0;
+		other._mapped = false;
+		return *this;
+	}
+	file_view_t(const file_view_t&) = delete;
+	file_view_t& operator=(const file_view_t&) = delete;
+	~file_view_t()
+	{
+		close();
+	}
+
+	bool open(const std::string& path, bool map = true)
+	{
+		close();
+		if (path.empty())
+			return false;
+#ifndef _WIN32
+		if (map) {
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat st;
+			if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+				void* p = mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED) {
+					::close(fd);
+					_data = static_cast<const char*>(p);
+					_size = std::size_t(st.st_size);
+					_mapped = true;
+					return true;
+				}
+			}
+			::close(fd);
+		}
+#endif
+		std::ifstream is(path.c_str());
+		if (!is)
+			return false;
+		_content = read_istream(is);
+		_data = _content.data();
+		_size = _content.size();
+		return true;
+	}
+	void close()
+	{
+#ifndef _WIN32
+		if (_mapped)
+			munmap(const_cast<char*>(_data), _size);
+#endif
+		_content.clear();
+		_data = nullptr;
+		_size = 0;
+		_mapped = false;
+	}
+
+	const char* data() const { return _data; }
+	std::size_t size() const { return _size; }
+	string_view_t view() const { return string_view_t(_data, _size); }
+
+private:
+	std::string _content; /* when not mapped */
+	const char* _data;
+	std::size_t _size;
+	bool _mapped;
+};
+
+// writes content to filename after making a backup in filename.bak
+// the file is rewritten in place, which keeps symlinks, permissions and ownership
 bool safe_write_file(const std::string& filename, const std::string& content)
 {
 	if (filename.empty())
@@ -127,6 +269,40 @@ bool safe_write_file(const std::string& filename, const std::string& content)
 	return true;
 }
 
+// calls f(i) for all i in [0,count) on at most threads threads, 0 uses all cores
+// the first exception thrown by f stops the remaining calls and is rethrown after all threads have finished
+template<typename F>
+void parallel_for(std::size_t count, unsigned threads, F f)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	if (threads > count)
+		threads = unsigned(count);
+	std::atomic<std::size_t> next(0);
+	std::exception_ptr error;
+	std::mutex errormutex;
+	auto worker = [&]()
+	{
+		try {
+			for (std::size_t i = next++; i < count; i = next++)
+				f(i);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(errormutex);
+			if (!error)
+				error = std::current_exception();
+			next = count;
+		}
+	};
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads; ++t)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& thread : pool)
+		thread.join();
+	if (error)
+		std::rethrow_exception(error);
+}
+
 std::string getenvvar(const std::string& key) {
 	char* str = getenv(key.c_str());
 	if (str == 0)
@@ -162,20 +338,26 @@ void add_entry_to_mainbibfile(const std::string& entry, bool prepend = true)
 
 void replace_in_file(const std::string& filename, const std::string& needle, const std::string& replacement)
 {
-	std::string content;
-	if (!read_file(filename, content))
+	file_view_t view;
+	if (!view.open(filename, false) || needle.empty())
 		return;
-	bool changed = false;
-	std::string::size_type pos;
-	while ((pos = content.find(needle)) != std::string::npos) {
-		content.erase(pos, needle.size());
-		content.insert(pos, replacement);
-		changed = true;
-	}
-	if (changed) {
-		std::cout << "Replaced '" << needle << "' with '" << replacement << "' in tex file: '" << filename << "'" << std::endl;
-		safe_write_file(filename, content);
+	string_view_t content = view.view();
+	std::string::size_type pos = content.find(string_view_t(needle.data(), needle.size()));
+	if (pos == std::string::npos)
+		return;
+	// copy the content only when it changes
+	std::string newcontent;
+	newcontent.reserve(content.size() + replacement.size());
+	std::string::size_type pos_start = 0;
+	for (; pos != std::string::npos; pos = content.find(string_view_t(needle.data(), needle.size()), pos_start)) {
+		newcontent.append(content.data() + pos_start, pos - pos_start);
+		newcontent.append(replacement);
+		pos_start = pos + needle.size();
 	}
+	newcontent.append(content.data() + pos_start, content.size() - pos_start);
+	view.close();
+	std::cout << "Replaced '" << needle << "' with '" << replacement << "' in tex file: '" << filename << "'" << std::endl;
+	safe_write_file(filename, newcontent);
 }
 
 /*** replace search citations ***/
@@ -8,6 +8,7 @@
 
 #include "core.hpp"
 #include "network.hpp"
+#include "transport.hpp"
 #include "bib_search.hpp"
 #include "bib_get.hpp"
 #include "bib_parse.hpp"
@@ -21,75 +22,344 @@ namespace sa = string_algo;
 #include <iostream>
 #include <fstream>
 #include <cstdio>
+#include <cstdlib>
 #include <locale>
 
 #include <string>
 #include <vector>
 #include <set>
 #include <map>
+#include <deque>
+#include <sstream>
+#include <thread>
 
 using namespace std;
 
 parameters_type params;
+new_version_t newversion; /* result of the new version check */
 
-/*** parse bibfiles ***/
-void parse_bibfile(const string& bibfile, bool verbose = true)
-{
-	if (mainbibfile.empty())
-		mainbibfile = bibfile;
-	if (verbose)
-		cout << "Parsing bibfile: '" << bibfile << "'" << endl;
-	string bibstr;
-	read_file(bibfile, bibstr);
-
-	/* find all cross references */
-	string::size_type pos = sa::to_lower_copy(bibstr).find("crossref");
-	while (pos  < bibstr.length()) {
-		string tmp = sa::trim_copy(bibstr.substr(pos + 8));
-		if (tmp.length() == 0 || tmp[0] != '=') {
-			pos = sa::to_lower_copy(bibstr).find("crossref", pos+1);
-			continue;
+/*** persistent parse index ***/
+
+// usage: bibparsecache.open(dir) enables the cache, bibparsecache.load(filename, content, entries, crossrefs)
+// returns the parse results of a previous run when the fingerprint of the bib file still matches,
+// bibparsecache.store(...) saves them in a sidecar file named by the hash of the absolute path
+// the fingerprint consists of the program version and the record size, which change the index layout or the parse results,
+// the path, size, modification time and content hash of the bib file, and the configured entry types
+class bib_parse_cache_t {
+public:
+	bool open(const std::string& dir)
+	{
+		_dir.clear();
+		if (dir.empty())
+			return false;
+		try {
+			fs::create_directories(fs::path(dir) / "parse");
+		} catch (std::exception& e) {
+			std::cerr << "Cannot create cache directory '" << dir << "': " << e.what() << std::endl;
+			return false;
 		}
-		tmp.erase(tmp.find(','));
-		tmp = sa::trim_copy(tmp, " =,{}'\"");
-		if (!tmp.empty()) {
-			if (verbose)
-				cout << "\t crossref: '" << tmp << "'" << endl;
-			havecitreferences.insert(tmp);
+		_dir = dir;
+		return true;
+	}
+	bool enabled() const { return !_dir.empty(); }
+
+	bool load(const std::string& filename, string_view_t content, std::vector<bib_entry_pos_t>& entries, std::vector<std::string>& crossrefs) const
+	{
+		entries.clear();
+		crossrefs.clear();
+		if (!enabled())
+			return false;
+		std::string path = _path(filename);
+		// binary mode, file_view_t reads in text mode on Windows
+		std::ifstream ifs(_filename(path).c_str(), std::ios::binary);
+		if (!ifs)
+			return false;
+		std::string data = read_istream(ifs);
+		string_view_t index(data);
+		std::string fingerprint = _fingerprint(path, content);
+		if (index.substr(0, fingerprint.size()) != fingerprint)
+			return false;
+		index.remove_prefix(fingerprint.size());
+		// entry positions are stored as native binary records, the cache is not shared between machines
+		std::size_t count = 0;
+		if (index.size() < sizeof(count))
+			return false;
+		std::memcpy(&count, index.data(), sizeof(count));
+		index.remove_prefix(sizeof(count));
+		if (index.size() / sizeof(bib_entry_pos_t) < count)
+			return false;
+		entries.resize(count);
+		if (count != 0)
+			std::memcpy(&entries[0], index.data(), count * sizeof(bib_entry_pos_t));
+		index.remove_prefix(count * sizeof(bib_entry_pos_t));
+		for (auto& entry : entries)
+			if (entry.end > content.size() || entry.typeend > entry.end || entry.keyend > entry.end)
+				return _fail(entries, crossrefs);
+		// followed by one crossref per line
+		while (!index.empty())
+		{
+			std::size_t eol = index.find('\n');
+			if (eol == string_view_t::npos)
+				return _fail(entries, crossrefs);
+			crossrefs.emplace_back(index.data(), eol);
+			index.remove_prefix(eol + 1);
 		}
-		pos = bibstr.find("crossref", pos+1);
-	}
-	/* find all citations */
-	string::size_type pos2;
-	pos = str_findbibentry(bibstr, 0);
-	while (pos < bibstr.length()) {
-		pos2 = str_findbibentry(bibstr, pos+1);
-		string entry = sa::trim_copy(bibstr.substr(pos, (pos2==string::npos ? pos2 : pos2-pos) ));
-		string key = entry.substr(entry.find_first_of("{(")+1);
-		sa::to_lower(entry);
-		key.erase(key.find(','));
-		sa::trim(key);
-		string lowerkey = sa::to_lower_copy(key); // case-insensitive cite-key
-		if (!key.empty()) {
-			tosearchcitations_complete[key] = entry;
-			havecitations.insert(lowerkey);
-			if (verbose) {
-				string cittype = sa::trim_copy(entry.substr(1, bibstr.find_first_of("{(")-1));
-				cout << "\t " << cittype << ": '" << key << "'" << endl;
-			}
+		return true;
+	}
+
+	bool store(const std::string& filename, string_view_t content, const std::vector<bib_entry_pos_t>& entries, const std::vector<std::string>& crossrefs) const
+	{
+		if (!enabled())
+			return false;
+		std::string path = _path(filename);
+		std::string index = _fingerprint(path, content);
+		std::size_t count = entries.size();
+		index.append(reinterpret_cast<const char*>(&count), sizeof(count));
+		if (count != 0)
+			index.append(reinterpret_cast<const char*>(&entries[0]), count * sizeof(bib_entry_pos_t));
+		for (auto& crossref : crossrefs)
+		{
+			if (crossref.find('\n') != std::string::npos)
+				return false;
+			index += crossref + "\n";
 		}
-		pos = pos2;
+		return atomic_write_file(_filename(path), index);
+	}
+
+private:
+	static bool _fail(std::vector<bib_entry_pos_t>& entries, std::vector<std::string>& crossrefs)
+	{
+		entries.clear();
+		crossrefs.clear();
+		return false;
+	}
+	static std::string _path(const std::string& filename)
+	{
+		try {
+			return fs::absolute(filename).string();
+		} catch (...) {
+			return filename;
+		}
+	}
+	std::string _filename(const std::string& path) const
+	{
+		return (fs::path(_dir) / "parse" / (hex_hash(path) + ".index")).string();
+	}
+	// FNV-1a over 64-bit words with an extra shift to mix the high bits down,
+	// hashing byte by byte would cost about as much as parsing
+	static std::uint64_t _content_hash(string_view_t content)
+	{
+		std::uint64_t h = 0xcbf29ce484222325ULL;
+		std::size_t i = 0;
+		for (; i + 8 <= content.size(); i += 8)
+		{
+			std::uint64_t word;
+			std::memcpy(&word, content.data() + i, 8);
+			h = (h ^ word) * 0x100000001b3ULL;
+			h ^= h >> 32;
+		}
+		return h ^ fnv1a_hash(content.data() + i, content.size() - i);
+	}
+	static std::string _fingerprint(const std::string& path, string_view_t content)
+	{
+		std::ostringstream oss;
+		oss << "dblpbibtex-parseindex 1\n"
+			<< "version: " << DBLPBIBTEX_VERSION << "\n"
+			<< "record: " << sizeof(bib_entry_pos_t) << "\n"
+			<< "path: " << path << "\n"
+			<< "size: " << content.size() << "\n"
+			<< "mtime: " << file_mtime(path) << "\n"
+			<< "hash: " << std::hex << _content_hash(content) << std::dec << "\n"
+			<< "types:";
+		for (auto& type : bib_extra_types)
+			oss << ' ' << type.data();
+		oss << "\n\n";
+		return oss.str();
+	}
+
+	std::string _dir;
+};
+
+bib_parse_cache_t bibparsecache;
+
+/*** parse bibfiles ***/
+// part of a bib file that is parsed independently, chunks start where a line starts with a command such as '@article{'
+struct bibfile_chunk_t {
+	bibfile_chunk_t(std::size_t _begin, std::size_t _end)
+		: begin(_begin), end(_end)
+	{
+	}
+
+	std::size_t begin, end;
+	vector<bib_entry_pos_t> entries; /* positions in the bib file */
+	vector<string> crossrefs;
+	std::ostringstream log; /* verbose output */
+	vector<string> stringsdefined; /* lower case names defined by @string */
+	vector<string_view_t> macrosundefined; /* macros used without an earlier @string in the chunk */
+};
+
+// result of parsing one bib file, the chunks of all bib files are parsed concurrently,
+// merge_bibfile adds the results to bibindex and havecitreferences in the order of bibfiles
+struct bibfile_parse_t {
+	bibfile_parse_t(const string& _filename)
+		: filename(_filename), main(false), cached(false)
+	{
+	}
+
+	string filename; /* empty if the bib file was not found */
+	bool main; /* the main bib file, which is read instead of mapped since it is rewritten in place */
+	bool cached; /* parse results are loaded from bibparsecache */
+	file_view_t view;
+	std::deque<bibfile_chunk_t> chunks;
+	std::ostringstream log;
+};
+
+const std::size_t bibfile_chunk_minsize = 1 << 20;
+
+// collects the parsed entries and their crossrefs
+struct parse_bibfile_visitor_t
+	: public bib_visitor_t
+{
+	parse_bibfile_visitor_t(bibfile_chunk_t& _chunk, bool _verbose)
+		: chunk(_chunk), verbose(_verbose)
+	{
+	}
+	bool entry_begin(string_view_t type, string_view_t key)
+	{
+		if (verbose && !key.empty())
+			chunk.log << "\t " << sa::to_lower_copy(string(type)) << ": '" << key << "'" << endl;
+		return true;
+	}
+	void entry_field(string_view_t name, const bib_value_t& value)
+	{
+		if (!bib_iequals(name, "crossref"))
+			return;
+		string crossref(bib_trim(value.text));
+		if (crossref.empty())
+			return;
+		if (verbose)
+			chunk.log << "\t crossref: '" << crossref << "'" << endl;
+		chunk.crossrefs.push_back(crossref);
+	}
+	void entry_end(const bib_entry_pos_t& pos)
+	{
+		bib_entry_pos_t filepos = pos;
+		filepos.begin += chunk.begin;
+		filepos.end += chunk.begin;
+		filepos.typebegin += chunk.begin;
+		filepos.typeend += chunk.begin;
+		filepos.keybegin += chunk.begin;
+		filepos.keyend += chunk.begin;
+		chunk.entries.push_back(filepos);
+	}
+
+	bibfile_chunk_t& chunk;
+	bool verbose;
+};
+
+// opens the bib file and loads its parse results of a previous run when it did not change since
+void load_bibfile(bibfile_parse_t& result, bool verbose)
+{
+	if (result.filename.empty())
+		return;
+	result.view.open(result.filename, !result.main);
+	result.chunks.emplace_back(0, result.view.size());
+	bibfile_chunk_t& chunk = result.chunks.front();
+	result.cached = bibparsecache.load(result.filename, result.view.view(), chunk.entries, chunk.crossrefs);
+	if (!result.cached)
+		result.chunks.clear();
+	else if (verbose)
+		chunk.log << "\t loaded " << chunk.entries.size() << " entries from the parse cache" << endl;
+}
+
+// splits the bib file into at most maxchunks chunks
+void split_bibfile(bibfile_parse_t& result, unsigned maxchunks)
+{
+	const std::size_t size = result.view.size();
+	std::size_t chunks = std::max<std::size_t>(1, std::min<std::size_t>(maxchunks, size / bibfile_chunk_minsize));
+	bib_parser_t parser(result.view.data(), size);
+	for (std::size_t begin = 0, i = 1; begin < size || i == 1; ++i)
+	{
+		std::size_t end = i < chunks ? parser.next_boundary(std::max(begin + 1, size / chunks * i)) : size;
+		result.chunks.emplace_back(begin, end);
+		begin = end;
+	}
+}
+
+// does not access global state, so chunks can be parsed concurrently
+void parse_bibchunk(const bibfile_parse_t& result, bibfile_chunk_t& chunk, bool verbose)
+{
+	/* find all citations and their cross references in a single pass */
+	parse_bibfile_visitor_t visitor(chunk, verbose);
+	bib_parser_t parser(result.view.data() + chunk.begin, chunk.end - chunk.begin);
+	parser.parse(visitor);
+	chunk.stringsdefined = parser.strings_defined();
+	chunk.macrosundefined = parser.macros_undefined();
+}
+
+// a chunk that uses a macro that is not defined in it may need a @string of an earlier chunk,
+// then the bib file is parsed again as a whole
+void check_bibfile_macros(bibfile_parse_t& result, bool verbose)
+{
+	set<string> stringsdefined;
+	for (auto& chunk : result.chunks)
+	{
+		if (!stringsdefined.empty())
+			for (auto& macro : chunk.macrosundefined)
+				if (stringsdefined.count(sa::to_lower_copy(string(macro))) != 0)
+				{
+					result.chunks.clear();
+					result.chunks.emplace_back(0, result.view.size());
+					parse_bibchunk(result, result.chunks.front(), verbose);
+					return;
+				}
+		stringsdefined.insert(chunk.stringsdefined.begin(), chunk.stringsdefined.end());
+	}
+}
+
+// saves the parse results for the next run
+void store_bibfile(const bibfile_parse_t& result)
+{
+	if (result.filename.empty() || result.cached || !bibparsecache.enabled())
+		return;
+	vector<bib_entry_pos_t> entries;
+	vector<string> crossrefs;
+	for (auto& chunk : result.chunks)
+	{
+		entries.insert(entries.end(), chunk.entries.begin(), chunk.entries.end());
+		crossrefs.insert(crossrefs.end(), chunk.crossrefs.begin(), chunk.crossrefs.end());
+	}
+	bibparsecache.store(result.filename, result.view.view(), entries, crossrefs);
+}
+
+void merge_bibfile(bibfile_parse_t& result, bool verbose)
+{
+	cout << result.log.str();
+	if (result.filename.empty())
+		return;
+	if (verbose)
+		cout << "Parsing bibfile: '" << result.filename << "'" << endl;
+	// the first bib file found is the main bib file, unless it is configured
+	if (mainbibfile.empty())
+		mainbibfile = result.filename;
+	bibindex.add_buffer(std::move(result.view));
+	for (auto& chunk : result.chunks)
+	{
+		cout << chunk.log.str();
+		for (auto& entry : chunk.entries)
+			bibindex.add(entry);
+		havecitreferences.insert(chunk.crossrefs.begin(), chunk.crossrefs.end());
 	}
 }
 void parse_bibfiles(bool verbose = true) {
-	havecitations.clear();
+	bibindex.clear();
 	havecitreferences.clear();
-	tosearchcitations_complete.clear();
+	std::deque<bibfile_parse_t> results;
 	for (unsigned i = 0; i < bibfiles.size(); ++i) {
 		std::ifstream ifs(bibfiles[i].c_str());
 		if (ifs) {
 			ifs.close();
-			parse_bibfile(bibfiles[i], verbose);
+			results.emplace_back(bibfiles[i]);
 			continue;
 		}
 		ifs.close();
@@ -98,17 +368,48 @@ void parse_bibfiles(bool verbose = true) {
 			ifs.open((includedirs[j] + "/" + bibfiles[i]).c_str());
 			if (ifs) {
 				ifs.close();
-				parse_bibfile(includedirs[j] + "/" + bibfiles[i], verbose);
+				results.emplace_back(includedirs[j] + "/" + bibfiles[i]);
 				hasparsed = true;
 				break;
 			}
 			ifs.close();
 		}
 		if (hasparsed) continue;
-		cout << "Cannot find bibfile: '" << bibfiles[i] << "' in one of these directories: '.'";
+		results.emplace_back(string());
+		results.back().log << "Cannot find bibfile: '" << bibfiles[i] << "' in one of these directories: '.'";
 		for (unsigned j = 0; j < includedirs.size(); ++j)
-			cout << ", '" << includedirs[j] << "'";
-		cout << endl;
+			results.back().log << ", '" << includedirs[j] << "'";
+		results.back().log << endl;
+	}
+	// the first bib file found is the main bib file, unless it is configured
+	for (auto& result : results)
+		if (!result.filename.empty() && (mainbibfile.empty() || result.filename == mainbibfile)) {
+			result.main = true;
+			break;
+		}
+	unsigned threads = params.parsethreads != 0 ? params.parsethreads : std::max(1u, std::thread::hardware_concurrency());
+	// only bib files that changed since the previous run need to be parsed
+	parallel_for(results.size(), threads, [&](std::size_t i)
+		{
+			load_bibfile(results[i], verbose);
+		});
+	// split large bib files into chunks, then parse the chunks of all bib files concurrently
+	vector< pair<bibfile_parse_t*, bibfile_chunk_t*> > chunks;
+	for (auto& result : results) {
+		if (result.filename.empty() || result.cached)
+			continue;
+		split_bibfile(result, threads > 1 ? 4 * threads : 1);
+		for (auto& chunk : result.chunks)
+			chunks.emplace_back(&result, &chunk);
+	}
+	parallel_for(chunks.size(), threads, [&](std::size_t i)
+		{
+			parse_bibchunk(*chunks[i].first, *chunks[i].second, verbose);
+		});
+	for (auto& result : results) {
+		check_bibfile_macros(result, verbose);
+		store_bibfile(result);
+		merge_bibfile(result, verbose);
 	}
 }
 
@@ -153,9 +454,60 @@ try {
 		("dblpformat"
 			, po::value<string>(&dblpformat)->default_value("standard")
 			, "Choose DBLP bib format: 'compact'/'0', 'standard'/'1', 'crossref'/'2'")
+		("dblpmirror"
+			, po::value< vector<string> >(&params.dblpmirrors)
+			, "DBLP server, can be given multiple times: the first is used, slow requests are also sent to the next.\nDefaults to 'https://dblp.org', 'https://dblp.uni-trier.de' and 'https://dblp.dagstuhl.de'.")
+		("dblpbulkmin"
+			, po::value<unsigned>(&params.dblpbulkmin)->default_value(3)
+			, "Download the complete DBLP venue of a year when at least this number of its citations are missing, 0 disables.")
 		("nocryptoeprint"
 			, po::bool_switch(&params.nocryptoeprint)
 			, "Do not download new citations from IACR crypto eprint.")
+		("paralleldownloads"
+			, po::value<unsigned>(&params.paralleldownloads)->default_value(4)
+			, "Maximum number of concurrent downloads.")
+		("maxrequestrate"
+			, po::value<double>(&params.maxrequestrate)->default_value(10)
+			, "Maximum number of requests per second to each host.\nLowered automatically when a host throttles requests.")
+		("connecttimeout"
+			, po::value<unsigned>(&params.connecttimeout)->default_value(10)
+			, "Number of seconds to wait for a connection to a host.\nA host is skipped for a while after 3 consecutive connection failures.")
+		("cachedir"
+			, po::value<string>(&params.cachedir)->default_value("")
+			, "Set directory for cached downloads.\nDefaults to '$XDG_CACHE_HOME/dblpbibtex', '$HOME/.cache/dblpbibtex' or '%LOCALAPPDATA%/dblpbibtex'")
+		("nocache"
+			, po::bool_switch(&params.nocache)
+			, "Do not use cached downloads.")
+		("cachettl"
+			, po::value<unsigned>(&params.cachettl)->default_value(7)
+			, "Number of days after which cached downloads are revalidated.")
+		("negativecachettl"
+			, po::value<unsigned>(&params.negativecachettl)->default_value(24)
+			, "Number of hours during which citations that could not be found are not retried, 0 disables.")
+		("clearnegativecache"
+			, po::bool_switch(&params.clearnegativecache)
+			, "Retry all citations that could not be found in previous runs.")
+		("transport"
+			, po::value<string>(&params.transport)->default_value("live")
+			, "Retrieve URLs from: 'live' network, 'record' network responses into fixturefile, 'replay' responses from fixturefile without network access.")
+		("fixturefile"
+			, po::value<string>(&params.fixturefile)->default_value("dblpbibtex.fixture")
+			, "File with recorded network responses for transport 'record' and 'replay'.")
+		("replaylatency"
+			, po::value<unsigned>(&params.replaylatency)->default_value(0)
+			, "Simulated latency in milliseconds of each replayed network response.")
+		("replayhostlatency"
+			, po::value< vector<string> >(&params.replayhostlatencies)
+			, "Simulated latency of replayed responses from one host, as 'host=milliseconds', can be given multiple times, e.g. 'https://dblp.org=1500'.")
+		("bibentrytype"
+			, po::value< vector<string> >(&params.bibentrytypes)
+			, "Additional bib-entry type, can be given multiple times, e.g. biblatex types 'online' and 'software'.")
+		("parsethreads"
+			, po::value<unsigned>(&params.parsethreads)->default_value(0)
+			, "Number of threads that parse bib files, 0 uses all cores.")
+		("noparsecache"
+			, po::bool_switch(&params.noparsecache)
+			, "Do not cache the parse results of bib files in the cache directory.")
 		("addbibtexoption"
 			, po::value< vector<string> >(&params.bibtexaddargs)
 			, "Prepends string to bibtex commandline arguments")
@@ -189,6 +541,13 @@ try {
 		po::store(po::parse_config_file(ifs, desc), vm);
 	}
 	po::notify(vm);
+	if (params.dblpmirrors.empty())
+		params.dblpmirrors = { "https://dblp.org", "https://dblp.uni-trier.de", "https://dblp.dagstuhl.de" };
+	for (auto& mirror : params.dblpmirrors)
+		sa::trim_right(mirror, " /");
+	for (auto& type : params.bibentrytypes)
+		if (!add_bibentry_type(type))
+			cout << "Ignoring invalid bib-entry type: '" << type << "'" << endl;
 	for (unsigned i = 0; i < params.bibtexaddargs.size(); ++i) {
 		if (bibtexargs.length())
 			bibtexargs += " ";
@@ -231,15 +590,17 @@ try {
 		string auxfile2 = *auxfiles.begin();
 		auxfiles.erase(auxfile2);
 		cout << "Parsing auxfile: '" << auxfile2 << "'." << endl;
-		std::ifstream ifs(auxfile2.c_str());
-		if (!ifs) {
+		file_view_t auxview;
+		if (!auxview.open(auxfile2)) {
 			cout << "Cannot open auxfile!" << endl;
 			continue;
 		}
-		string auxline;
-		while (!!ifs) {
-			//cout << "@" << std::flush;
-			getline(ifs, auxline);
+		string_view_t auxcontent = auxview.view();
+		for (string::size_type pos = 0, eol = 0; pos < auxcontent.size(); pos = eol + 1) {
+			eol = auxcontent.find('\n', pos);
+			if (eol == string::npos)
+				eol = auxcontent.size();
+			string auxline(auxcontent.substr(pos, eol - pos));
 			sa::trim(auxline);
 			//cout << auxline << endl;
 			if (sa::starts_with(auxline, "\\citation{")) {
@@ -263,6 +624,17 @@ try {
 							dblpformat = citation.substr( string("dblpbibtex:dblpformat:").length() );
 						if (sa::istarts_with(citation, "dblpbibtex:nocryptoeprint"))
 							params.nocryptoeprint = true;
+						if (sa::istarts_with(citation, "dblpbibtex:paralleldownloads:")) {
+							try {
+								params.paralleldownloads = std::stoul(citation.substr( string("dblpbibtex:paralleldownloads:").length() ));
+							} catch (std::exception&) {
+								cerr << "Ignoring invalid option '" << citation << "', keeping " << params.paralleldownloads << " concurrent downloads." << endl;
+							}
+						}
+						if (sa::istarts_with(citation, "dblpbibtex:nocache"))
+							params.nocache = true;
+						if (sa::istarts_with(citation, "dblpbibtex:clearnegativecache"))
+							params.clearnegativecache = true;
 						if (sa::istarts_with(citation, "dblpbibtex:mainbibfile:")) {
 							params.mainbibfile = citation.substr( string("dblpbibtex:mainbibfile:").length() );
 							if (params.mainbibfile.find_last_of('.') == string::npos)
@@ -323,10 +695,62 @@ try {
 		cout << "\tNo downloads of new citations or crossrefs." << endl;
 	if (params.nodblp)
 		cout << "\tNo downloads from DBLP." << endl;
-	else
+	else {
 		cout << "\tDBLP format: " << dblpformat_name(params.dblpformat) << endl;
+		cout << "\tDBLP servers:";
+		for (auto& mirror : params.dblpmirrors)
+			cout << " '" << mirror << "'";
+		cout << endl;
+	}
 	if (params.nocryptoeprint)
 		cout << "\tNo downloads from cryptoeprint." << endl;
+	if (params.cachedir.empty())
+		params.cachedir = default_cache_dir();
+	if (params.nocache)
+		cout << "\tNo cached downloads." << endl;
+	else if (url_get.cache.open(params.cachedir, std::time_t(params.cachettl) * 24 * 60 * 60))
+		cout << "\tCache directory: '" << params.cachedir << "'" << endl;
+	params.paralleldownloads = std::max(1u, params.paralleldownloads);
+	url_get.ratelimit.configure(params.maxrequestrate, params.paralleldownloads);
+	url_get.connecttimeout = std::max(1L, long(params.connecttimeout));
+	sa::to_lower(params.transport);
+	if (params.transport == "record") {
+		cout << "\tRecording network responses to: '" << params.fixturefile << "'" << endl;
+		if (url_record.open(params.fixturefile, url_get))
+			url_transport = &url_record;
+	} else if (params.transport == "replay") {
+		cout << "\tReplaying network responses from: '" << params.fixturefile << "' with " << params.replaylatency << "ms latency" << endl;
+		if (!url_replay.open(params.fixturefile, params.replaylatency / 1000.0))
+			return 1;
+		for (auto& hostlatency : params.replayhostlatencies) {
+			string::size_type eq = hostlatency.find_last_of('=');
+			char* end = nullptr;
+			unsigned long latency = (eq == string::npos) ? 0 : std::strtoul(hostlatency.c_str() + eq + 1, &end, 10);
+			if (eq == string::npos || end == hostlatency.c_str() + eq + 1 || *end != 0) {
+				cout << "\tIgnoring invalid replay host latency: '" << hostlatency << "'" << endl;
+				continue;
+			}
+			string host = url_host(hostlatency.substr(0, eq));
+			cout << "\tReplaying responses from '" << host << "' with " << latency << "ms latency" << endl;
+			url_replay.hostlatency[host] = latency / 1000.0;
+		}
+		url_transport = &url_replay;
+		// replay runs are reproducible: no network access and no state of previous runs
+		params.nonewversioncheck = true;
+		params.negativecachettl = 0;
+	} else if (params.transport != "live")
+		cout << "\tUnknown transport '" << params.transport << "', using 'live'." << endl;
+	// check for new version in the background
+	if (!params.nonewversioncheck)
+		newversion = start_new_version_check(params.cachedir);
+	if (negativecitations.open(params.cachedir, std::time_t(params.negativecachettl) * 60 * 60) && params.clearnegativecache) {
+		cout << "\tCleared citations that could not be found in previous runs." << endl;
+		negativecitations.clear();
+	}
+	if (params.noparsecache)
+		cout << "\tNo cached parse results of bib files." << endl;
+	else
+		bibparsecache.open(params.cachedir);
 
 	cout << "Bib files:";
 	for (unsigned i = 0; i < bibfiles.size(); ++i)
@@ -347,31 +771,69 @@ try {
 		parse_bibfiles(false);
 
 		downloadedcitations.clear();
+		downloadedcitreferences.clear();
 
 		if (!load_mainbibfile()) {
 			cout << "Failed to load main bibfile: '" << mainbibfile << "'!" << endl;
 			break;
 		}
 		cout << "Loaded content of main bibfile: '" << mainbibfile << "'!" << endl;
+		// determine new citations and crossrefs and download them concurrently in advance
+		vector<string> newcitations, newcitreferences, prefetchkeys;
 		for (set<string>::const_iterator cit = citations.begin(); cit != citations.end(); ++cit)
-			if (havecitations.find(sa::to_lower_copy(*cit)) == havecitations.end()) {
-				if (checkedcitations.find(sa::to_lower_copy(*cit)) != checkedcitations.end())
-					continue;
-				checkedcitations.insert(sa::to_lower_copy(*cit));
-				cout << "New citation: '" << *cit << "'" << endl;
-				if (download_citation(*cit))
-					downloadedcitations.insert(*cit);
-			}
+			if (!bibindex.contains(*cit)
+				&& checkedcitations.find(sa::to_lower_copy(*cit)) == checkedcitations.end())
+				newcitations.push_back(*cit);
 		for (set<string>::const_iterator cit = havecitreferences.begin(); cit != havecitreferences.end(); ++cit)
-			if (havecitations.find(sa::to_lower_copy(*cit)) == havecitations.end()) {
-				cout << "(NEW) crossref: '" << *cit << "'" << endl;
-				if (checkedcitations.find(sa::to_lower_copy(*cit)) != checkedcitations.end())
-					continue;
-				checkedcitations.insert(sa::to_lower_copy(*cit));
-				cout << "New crossref: '" << *cit << "'" << endl;
-				if (download_citation(*cit, false)) // always add crossrefs at the end
-					downloadedcitations.insert(*cit);
+			if (!bibindex.contains(*cit))
+				newcitreferences.push_back(*cit);
+		// skip keys that could not be resolved in previous runs
+		for (auto& cit : newcitations)
+			if (negativecitations.contains(cit) && checkedcitations.insert(sa::to_lower_copy(cit)).second)
+				cout << "Skipping citation not found in a previous run: '" << cit << "'" << endl;
+		for (auto& cit : newcitreferences)
+			if (negativecitations.contains(cit) && checkedcitations.insert(sa::to_lower_copy(cit)).second)
+				cout << "Skipping crossref not found in a previous run: '" << cit << "'" << endl;
+		for (auto& cit : newcitations)
+			if (checkedcitations.find(sa::to_lower_copy(cit)) == checkedcitations.end())
+				prefetchkeys.push_back(cit);
+		for (auto& cit : newcitreferences)
+			if (checkedcitations.find(sa::to_lower_copy(cit)) == checkedcitations.end())
+				prefetchkeys.push_back(cit);
+		prefetch_citations(prefetchkeys);
+		// process in the same order as before to obtain a deterministic main bibfile
+		for (vector<string>::const_iterator cit = newcitations.begin(); cit != newcitations.end(); ++cit) {
+			if (checkedcitations.find(sa::to_lower_copy(*cit)) != checkedcitations.end())
+				continue;
+			checkedcitations.insert(sa::to_lower_copy(*cit));
+			cout << "New citation: '" << *cit << "'" << endl;
+			if (download_citation(*cit))
+				downloadedcitations.insert(*cit);
+		}
+		for (vector<string>::const_iterator cit = newcitreferences.begin(); cit != newcitreferences.end(); ++cit) {
+			cout << "(NEW) crossref: '" << *cit << "'" << endl;
+			if (checkedcitations.find(sa::to_lower_copy(*cit)) != checkedcitations.end())
+				continue;
+			checkedcitations.insert(sa::to_lower_copy(*cit));
+			cout << "New crossref: '" << *cit << "'" << endl;
+			if (download_citation(*cit, false)) // always add crossrefs at the end
+				downloadedcitations.insert(*cit);
+		}
+		// crossrefs of the entries downloaded above, these would otherwise only be found in the next pass
+		for (size_t i = 0; i < downloadedcitreferences.size(); ++i) {
+			const string cit = downloadedcitreferences[i];
+			if (bibindex.contains(cit)
+				|| checkedcitations.find(sa::to_lower_copy(cit)) != checkedcitations.end())
+				continue;
+			checkedcitations.insert(sa::to_lower_copy(cit));
+			if (negativecitations.contains(cit)) {
+				cout << "Skipping crossref not found in a previous run: '" << cit << "'" << endl;
+				continue;
 			}
+			cout << "New crossref: '" << cit << "'" << endl;
+			if (download_citation(cit, false)) // always add crossrefs at the end
+				downloadedcitations.insert(cit);
+		}
 		if (downloadedcitations.empty() || params.nodownload) {
 			cout << "No updates to save to main bibfile: '" << mainbibfile << "'!" << endl;
 			break;
@@ -382,6 +844,9 @@ try {
 		}
 		cout << "Saved new content of main bibfile: '" << mainbibfile << "'!" << endl;
 	}
+	negativecitations.save();
+	if (url_transport == &url_record)
+		url_record.save();
 
 	/* when enabled in .tex file, remove all obsolete entries from main bib file */
 	while (params.cleanupmainbib) {
@@ -394,42 +859,27 @@ try {
 		// merge aux citations and all crossrefs
 		set<string> needed_bib_entries = citations;
 		needed_bib_entries.insert(havecitreferences.begin(), havecitreferences.end());
-		// split mainbibfilecontent into parts
-		vector<string::size_type> mainbibentryoffsets;
-		vector< pair<string,string> > mainbibentries;
-		/* find all citations */
-		string::size_type pos_start = 0;
-		while (true) {
-			string::size_type pos = mainbibfilecontent.find('@', pos_start);
-			if (pos == string::npos) break;
-			pos_start = pos+1;
-			string bibstr = mainbibfilecontent.substr(pos);
-			string cittype = sa::trim_copy(sa::to_lower_copy(bibstr.substr(1, bibstr.find_first_of("{(")-1)));
-			if (cittype == "article" || cittype == "book" || cittype == "booklet" || cittype == "inbook"
-				|| cittype == "incollection" || cittype == "inproceedings" || cittype == "manual"
-				|| cittype == "mastersthesis" || cittype == "misc" || cittype == "phdthesis"
-				|| cittype == "proceedings" || cittype == "techreport" || cittype == "unpublished")
-				mainbibentryoffsets.push_back(pos);
-		}
+		// split mainbibfilecontent into entries, each with the text up to the next entry
+		bib_entries_visitor_t visitor;
+		bib_parser_t(mainbibfilecontent).parse(visitor);
+		vector<string> mainbibentries;
 		bool changed = false;
-		for (unsigned i = 0; i < mainbibentryoffsets.size(); ++i) {
-			string::size_type pos = mainbibentryoffsets[i], pos2 = mainbibfilecontent.length();
-			if (i+1 < mainbibentryoffsets.size())
-				pos2 = mainbibentryoffsets[i+1];
-			string bibstr = mainbibfilecontent.substr(pos, pos2-pos);
-			string cittype = sa::trim_copy(sa::to_lower_copy(bibstr.substr(0, bibstr.find_first_of("{("))));
-			bibstr.erase(0, bibstr.find_first_of("{(")+1);
-			string key = sa::trim_copy(bibstr.substr(0, bibstr.find(',')));
+		for (size_t i = 0; i < visitor.entries.size(); ++i) {
+			const bib_entry_pos_t& entry = visitor.entries[i];
+			string::size_type pos2 = mainbibfilecontent.length();
+			if (i+1 < visitor.entries.size())
+				pos2 = visitor.entries[i+1].begin;
+			string key = mainbibfilecontent.substr(entry.keybegin, entry.keyend - entry.keybegin);
 			if (needed_bib_entries.find(key) != needed_bib_entries.end())
-				mainbibentries.push_back( pair<string,string>(key, sa::trim_copy(mainbibfilecontent.substr(pos, pos2-pos), " \r\n")) );
+				mainbibentries.push_back(sa::trim_copy(mainbibfilecontent.substr(entry.begin, pos2 - entry.begin), " \r\n"));
 			else {
 				cout << "Removed entry from main bibfile: '" << key << "'" << endl;
 				changed = true;
 			}
 		}
 		mainbibfilecontent.clear();
-		for (unsigned i = 0; i < mainbibentries.size(); ++i)
-			mainbibfilecontent += mainbibentries[i].second + "\n\n";
+		for (auto& bibentry : mainbibentries)
+			mainbibfilecontent += bibentry + "\n\n";
 		if (!changed) {
 			cout << "No clean up changes to save to main bibfile: '" << mainbibfile << "'!" << endl;
 			break;
@@ -448,12 +898,26 @@ try {
 
 try {
 	//Check for new version
-	if (!params.nonewversioncheck && url_get._havesuccess)
-		check_new_version();
+	report_new_version(newversion);
 } catch (std::exception& e) {
 	cerr << "Caught exception while checking new version: " << e.what() << endl;
 }
 
+	if (url_get.stats.requests != 0) {
+		const url_stats_t& stats = url_get.stats;
+		cout << "Network statistics: " << stats.requests << " requests, " << stats.wirebytes << " bytes received";
+		if (stats.bodybytes > stats.wirebytes)
+			cout << ", " << stats.bodybytes << " bytes decoded (" << stats.bodybytes - stats.wirebytes << " bytes saved by compression)";
+		cout << "." << endl;
+		if (stats.hedges != 0)
+			cout << "Hedged requests: " << stats.hedges << " sent to DBLP mirrors, " << stats.hedgewins << " answered first." << endl;
+	}
+	if (url_transport == &url_replay) {
+		cout << "Replay statistics: " << url_replay.replayed << " responses replayed, " << url_replay.missing << " requests without recorded response." << endl;
+		if (url_replay.hedges != 0)
+			cout << "Hedged requests: " << url_replay.hedges << " sent to DBLP mirrors, " << url_replay.hedgewins << " answered first." << endl;
+	}
+
 	/* Run bibtex */
 	cout << "Running bibtex: '" << params.bibtexcmd + " " + bibtexargs << "'." << endl;
 	return system((params.bibtexcmd + " " + bibtexargs).c_str());
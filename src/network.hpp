@@ -7,18 +7,22 @@
 #define DBLPBIBTEX_NETWORK_HPP
 
 #include "core.hpp"
+#include "cache.hpp"
 
 #include <curl/curl.h>
 
 #include <string>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <ctime>
 
-size_t _curl_write_callback(char* ptr, size_t size, size_t nmemb, void* _data)
-{
-	std::string& data = *static_cast<std::string*>(_data);
-	data.append(ptr, size * nmemb);
-	return size * nmemb;
-}
 size_t _curl_header_callback(char* ptr, size_t size, size_t nitems, void* _data)
 {
 	std::string& data = *static_cast<std::string*>(_data);
@@ -26,128 +30,1258 @@ size_t _curl_header_callback(char* ptr, size_t size, size_t nitems, void* _data)
 	return size * nitems;
 }
 
+// returns the connection scheme, host and port part of url, e.g. "https://dblp.org"
+std::string url_host(const std::string& url)
+{
+	std::string::size_type pos = url.find("://");
+	pos = (pos == std::string::npos) ? 0 : pos + 3;
+	return url.substr(0, url.find_first_of("/?#", pos));
+}
+
+// returns the value of the last occurrence of header field name (case-insensitive) in header string
+std::string http_header_value(const std::string& header, const std::string& name)
+{
+	std::string value;
+	std::string::size_type pos = 0;
+	while (pos < header.size())
+	{
+		std::string::size_type eol = header.find('\n', pos);
+		if (eol == std::string::npos)
+			eol = header.size();
+		std::string::size_type colon = header.find(':', pos);
+		if (colon < eol && sa::iequals(sa::trim_copy(header.substr(pos, colon - pos)), name))
+			value = sa::trim_copy(header.substr(colon + 1, eol - colon - 1));
+		pos = eol + 1;
+	}
+	return value;
+}
+
+// returns the status code of the last response in header string, or 0 if there is none
+long http_response_code(const std::string& header)
+{
+	long code = 0;
+	std::string::size_type pos = 0;
+	while ((pos = header.find("HTTP/", pos)) != std::string::npos)
+	{
+		if (pos == 0 || header[pos - 1] == '\n')
+		{
+			std::string::size_type space = header.find(' ', pos);
+			if (space != std::string::npos)
+				code = std::strtol(header.c_str() + space + 1, nullptr, 10);
+		}
+		pos += 5;
+	}
+	return code;
+}
+
+// returns true if a response with status code makes requests to other mirrors unnecessary:
+// a complete response, or a 304 Not Modified for a request that revalidates a cached copy
+// redirects (mirrors are not followed), client errors and server errors leave the other mirrors to answer
+bool url_answered(long status, bool havecached)
+{
+	return status == 200 || (status == 304 && havecached);
+}
+
+typedef std::vector<std::pair<std::string,std::string>> url_postdata_t;
+
+// returns true when the received data so far contains everything the caller needs
+// it is called with growing data and may keep state to continue scanning where its previous call stopped,
+// every attempt of a transfer calls its own copy
+typedef std::function<bool(const std::string& data)> url_complete_t;
+
+// a GET request for url, of which the transfer can stop as soon as complete(data) returns true
+// when url is slow to respond, the same request is sent to the mirrors in order and the first response is used
+struct url_request_t {
+	url_request_t(const std::string& _url, const url_complete_t& _complete = url_complete_t())
+		: url(_url), complete(_complete)
+	{
+	}
+
+	std::string url;
+	url_complete_t complete;
+	std::vector<std::string> mirrors; /* urls of the same resource on other hosts */
+};
+
+// identifies identical requests: url and postdata
+std::string url_request_key(const std::string& url, const url_postdata_t& postdata = url_postdata_t())
+{
+	std::string key = url;
+	for (auto& pd : postdata)
+		key += "\n" + pd.first + "=" + pd.second;
+	return key;
+}
+
+// interface of the backends that retrieve urls: the live network url_get, and url_record and url_replay
+// usage: see url_get_t, all functions return pair<string,string> containing (header string, data string)
+// and on error they return empty header string and data string
+class url_transport_t {
+public:
+	virtual ~url_transport_t() {}
+
+	virtual std::pair<std::string,std::string> get(const std::string& url, const url_postdata_t& postdata = url_postdata_t()) = 0;
+	virtual std::pair<std::string,std::string> get_cached(const url_request_t& request) = 0;
+	virtual void prefetch(const std::vector<url_request_t>& requests, unsigned parallel) = 0;
+};
+
+// state of a single transfer from set up until it is finished
+struct url_transfer_t {
+	url_transfer_t(const std::string& _url, const url_postdata_t& _postdata = url_postdata_t())
+		: url(_url), postdata(_postdata), key(url_request_key(_url, _postdata)), host(url_host(_url)), curl(nullptr), headers(nullptr), status(0), attempts(0), timeout(0)
+		, maxbodysize(0), reserved(false), stopped(false), toolarge(false), cacheable(false), havecached(false), stale(false)
+		, primary(nullptr), inflight(0)
+#ifdef USE_CURL_FORM
+		, post(nullptr)
+#else
+		, mime(nullptr)
+#endif
+	{
+	}
+
+	std::string url;
+	url_postdata_t postdata;
+	std::string key; /* identifies identical requests: url and postdata */
+	std::string host;
+	std::string header, data;
+	CURL* curl;
+	curl_slist* headers;
+	long status; /* HTTP response code */
+	unsigned attempts; /* number of throttled attempts */
+	long timeout; /* in seconds for the whole transfer, 0 for no limit */
+	url_complete_t complete; /* unused, copied for every attempt */
+	url_complete_t completecheck; /* copy of complete used by the current attempt */
+	std::size_t maxbodysize; /* 0 for unlimited */
+	bool reserved; /* data has been reserved using Content-Length */
+	bool stopped; /* transfer has been stopped early because data is complete */
+	bool toolarge; /* transfer has been aborted because body exceeds maxbodysize */
+	bool cacheable; /* use on-disk cache */
+	bool havecached; /* cached contains a stale cache entry to revalidate */
+	bool stale; /* the request failed and has been completed with the stale cache entry */
+	http_cache_entry_t cached;
+	std::chrono::steady_clock::time_point started; /* when the request was sent */
+	std::vector<std::string> mirrors; /* mirror urls that have not been tried yet */
+	url_transfer_t* primary; /* for a hedged request: the transfer it hedges */
+	std::vector<std::unique_ptr<url_transfer_t>> hedges; /* hedged requests to mirrors */
+	unsigned inflight; /* number of active transfers of this request and its hedged requests */
+	std::chrono::steady_clock::time_point hedgeat; /* when to send the next hedged request */
+#ifdef USE_CURL_FORM
+	curl_httppost* post;
+#else
+	curl_mime* mime;
+#endif
+
+	// process received body data, returns false to abort the transfer
+	bool write(const char* ptr, std::size_t size)
+	{
+		// remaining data after completion is discarded, the transfer is stopped unless that would close
+		// a keep-alive HTTP/1.x connection only shortly before the end of the response
+		if (stopped)
+			return _finish_after_complete();
+		if (!reserved)
+		{
+			reserved = true;
+			// the Content-Length of an encoded response is the size before decoding
+			curl_off_t contentlength = http_header_value(header, "Content-Encoding").empty() ? _content_length() : -1;
+			if (contentlength > 0)
+				data.reserve(maxbodysize == 0 ? std::size_t(contentlength) : std::min(std::size_t(contentlength), maxbodysize));
+		}
+		if (maxbodysize != 0 && data.size() + size > maxbodysize)
+		{
+			toolarge = true;
+			return false;
+		}
+		data.append(ptr, size);
+		if (completecheck && _status() == 200 && completecheck(data))
+		{
+			stopped = true;
+			return _finish_after_complete();
+		}
+		return true;
+	}
+
+private:
+	long _status() const
+	{
+		long status = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		return status;
+	}
+	curl_off_t _content_length() const
+	{
+#if LIBCURL_VERSION_NUM >= 0x073700
+		curl_off_t contentlength = -1;
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentlength);
+		return contentlength;
+#else
+		double contentlength = -1;
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &contentlength);
+		return curl_off_t(contentlength);
+#endif
+	}
+	bool _finish_after_complete() const
+	{
+		const curl_off_t maxdiscard = 16 * 1024;
+#if LIBCURL_VERSION_NUM >= 0x073200
+		long httpversion = 0;
+		curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &httpversion);
+		// stopping an HTTP/2 stream leaves the connection intact
+		if (httpversion == CURL_HTTP_VERSION_2_0)
+			return false;
+#endif
+		curl_off_t contentlength = _content_length();
+		if (contentlength < 0)
+			return false;
+#if LIBCURL_VERSION_NUM >= 0x073700
+		curl_off_t received = 0;
+		curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+#else
+		double _received = 0;
+		curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &_received);
+		curl_off_t received = curl_off_t(_received);
+#endif
+		return contentlength - received <= maxdiscard;
+	}
+};
+
+size_t _curl_write_callback(char* ptr, size_t size, size_t nmemb, void* _transfer)
+{
+	url_transfer_t& transfer = *static_cast<url_transfer_t*>(_transfer);
+	if (!transfer.write(ptr, size * nmemb))
+		return 0;
+	return size * nmemb;
+}
+
+// network statistics of a run
+struct url_stats_t {
+	url_stats_t()
+		: requests(0), wirebytes(0), bodybytes(0), hedges(0), hedgewins(0)
+	{
+	}
+
+	unsigned requests;
+	unsigned long long wirebytes; /* received body bytes before content decoding */
+	unsigned long long bodybytes; /* body bytes after content decoding */
+	unsigned hedges; /* hedged requests sent to mirrors */
+	unsigned hedgewins; /* hedged requests that answered first */
+};
+
+// per-host rate limiter: a token bucket limits the request rate and a window limits the concurrent requests
+// both are adjusted AIMD-style: halved when the host throttles us, and additively increased on success
+// usage: ratelimit.acquire(host) before each request, ratelimit.release(host, throttled, retryafter) afterwards
+class url_rate_limiter_t {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	url_rate_limiter_t()
+		: _maxrate(10), _maxconcurrency(4)
+	{
+	}
+
+	// maxrate in requests per second per host, maxconcurrency in concurrent requests per host
+	void configure(double maxrate, unsigned maxconcurrency)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_maxrate = maxrate > 0 ? maxrate : 1;
+		_maxconcurrency = maxconcurrency > 0 ? maxconcurrency : 1;
+		_hosts.clear();
+	}
+
+	// returns true and reserves a request slot if a request to host may start now,
+	// otherwise returns false and sets wait to the number of seconds after which it may start
+	bool try_acquire(const std::string& host, double& wait)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		host_state& h = _host(host);
+		clock::time_point now = clock::now();
+		h.tokens = std::min(std::max(h.rate, 1.0), h.tokens + h.rate * std::chrono::duration<double>(now - h.refilled).count());
+		h.refilled = now;
+		if (now < h.blockeduntil)
+		{
+			wait = std::chrono::duration<double>(h.blockeduntil - now).count();
+			return false;
+		}
+		if (h.active >= h.concurrency)
+		{
+			wait = 0.05;
+			return false;
+		}
+		if (h.tokens < 1)
+		{
+			wait = (1 - h.tokens) / h.rate;
+			return false;
+		}
+		h.tokens -= 1;
+		++h.active;
+		return true;
+	}
+	void acquire(const std::string& host)
+	{
+		double wait;
+		while (!try_acquire(host, wait))
+			std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+	}
+
+	// retryafter: number of seconds the host asked us to wait when throttled
+	void release(const std::string& host, bool throttled, double retryafter = 0)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		host_state& h = _host(host);
+		if (h.active > 0)
+			--h.active;
+		if (throttled)
+		{
+			h.concurrency = std::max(1u, h.concurrency / 2);
+			h.rate = std::max(_maxrate / 64, h.rate / 2);
+			h.tokens = std::min(h.tokens, 0.0);
+			h.successes = 0;
+			h.blockeduntil = std::max(h.blockeduntil, clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(retryafter)));
+			return;
+		}
+		h.rate = std::min(_maxrate, h.rate + _maxrate / 16);
+		// increase concurrency by one after a full window of successful requests
+		if (++h.successes >= h.concurrency)
+		{
+			h.successes = 0;
+			h.concurrency = std::min(_maxconcurrency, h.concurrency + 1);
+		}
+	}
+
+private:
+	struct host_state {
+		double rate; /* tokens per second */
+		double tokens;
+		clock::time_point refilled;
+		clock::time_point blockeduntil; /* from Retry-After */
+		unsigned concurrency; /* current concurrency window */
+		unsigned active;
+		unsigned successes;
+	};
+	host_state& _host(const std::string& host)
+	{
+		auto it = _hosts.find(host);
+		if (it != _hosts.end())
+			return it->second;
+		host_state& h = _hosts[host];
+		h.rate = _maxrate;
+		h.tokens = std::max(_maxrate, 1.0);
+		h.refilled = h.blockeduntil = clock::now();
+		h.concurrency = _maxconcurrency;
+		h.active = h.successes = 0;
+		return h;
+	}
+
+	std::mutex _mutex;
+	std::map<std::string, host_state> _hosts;
+	double _maxrate;
+	unsigned _maxconcurrency;
+};
+
 // usage: url_get(url [,postdata]) with e.g. url="https://dblp.org/"
 // returns: pair<string,string> containing (header string, data string)
 // on error it returns empty header string and data string and outputs error message to cerr
-class url_get_t {
+// easy handles are kept in a per-host pool, so that consecutive requests to the same host reuse a warm connection
+// all handles share one DNS cache and TLS session cache, so only the first request to each host pays for
+// name resolution and a full TLS handshake, live connections stay with the pooled handle that opened them
+// url_get may be used from several threads concurrently, prefetch only from one thread at a time
+// requests are scheduled per host by the rate limiter url_get.ratelimit, throttled requests (HTTP 429, or 503 with
+// Retry-After) are retried after the requested delay
+// after several consecutive connect or DNS failures the host is marked down and its requests are skipped,
+// after a cooldown a cheap connect-only probe reopens the host when it is reachable again
+// usage: url_get.get_cached(url) is like url_get(url), but uses the on-disk cache url_get.cache when it is opened:
+// fresh entries are returned without network access, stale entries are revalidated with a conditional GET
+// usage: url_get.prefetch(urls, parallel) downloads urls concurrently using curl's multi interface and the on-disk cache
+// identical requests are coalesced: successful responses are kept for the rest of the run, and concurrent callers
+// of a request that is in flight wait for that transfer and share its result, e.g., with prefetched urls
+// response bodies are limited to url_get.maxbodysize bytes, and get_cached and prefetch accept a url_request_t
+// whose completion predicate ends the transfer as soon as the data received so far contains everything needed
+// requests with mirrors are hedged: when no response has arrived within the 95th percentile of the recent response
+// times of the host, the request is also sent to the next mirror and the first response is used and cached for url
+class url_get_t
+	: public url_transport_t
+{
 public:
 	url_get_t()
-		: _curl(nullptr), _havesuccess(false)
+		: maxbodysize(16 << 20), hedgedelay(1), connecttimeout(10), _initialized(false), _share(nullptr), _multi(nullptr)
 	{
 	}
 	~url_get_t()
 	{
-		if (_curl == nullptr)
+		if (!_initialized)
 			return;
+		if (_multi != nullptr)
+			curl_multi_cleanup(_multi);
+		for (auto& hp : _pool)
+			for (CURL* curl : hp.second)
+				curl_easy_cleanup(curl);
+		_pool.clear();
+		// the share object can only be cleaned up once no easy handle uses it anymore
+		if (_share != nullptr)
+			curl_share_cleanup(_share);
 		curl_global_cleanup();
 	}
 
-	// TODO 1: detect protocol and hostname to reuse connections
-	// TODO 2: detect internet connection loss and stop trying
-	std::pair<std::string,std::string> operator()(const std::string& url, const std::vector<std::pair<std::string,std::string>>& postdata = std::vector<std::pair<std::string,std::string>>())
+	std::pair<std::string,std::string> operator()(const std::string& url, const url_postdata_t& postdata = url_postdata_t())
+	{
+		return get(url, postdata);
+	}
+
+	std::pair<std::string,std::string> get(const std::string& url, const url_postdata_t& postdata = url_postdata_t()) override
+	{
+		url_transfer_t transfer(url, postdata);
+		return _get(transfer);
+	}
+
+	// like get(url), but the transfer is aborted after timeout seconds
+	std::pair<std::string,std::string> get_timeout(const std::string& url, long timeout)
 	{
-		std::string _header, _data;
+		url_transfer_t transfer(url);
+		transfer.timeout = timeout;
+		return _get(transfer);
+	}
+
+	std::pair<std::string,std::string> get_cached(const url_request_t& request) override
+	{
+		// hedging requires concurrent transfers
+		if (!request.mirrors.empty())
+			prefetch(std::vector<url_request_t>(1, request), 1);
+		url_transfer_t transfer(request.url);
+		transfer.cacheable = true;
+		transfer.complete = request.complete;
+		return _get(transfer);
+	}
+
+	// download all urls with at most parallel concurrent transfers
+	void prefetch(const std::vector<url_request_t>& requests, unsigned parallel) override
+	{
+		if (parallel == 0)
+			parallel = 1;
+		std::vector<std::unique_ptr<url_transfer_t>> transfers;
+		std::set<std::string> queued;
+		for (auto& request : requests)
+		{
+			if (!queued.insert(request.url).second)
+				continue;
+			std::unique_ptr<url_transfer_t> transfer(new url_transfer_t(request.url));
+			transfer->cacheable = true;
+			transfer->complete = request.complete;
+			transfer->mirrors = request.mirrors;
+			// skip urls that completed before or are in flight in another thread
+			if (_join(transfer->key, nullptr) != _REGISTERED)
+				continue;
+			if (_cache_lookup(*transfer))
+				_complete(*transfer);
+			else
+				transfers.emplace_back(std::move(transfer));
+		}
+		if (transfers.empty())
+			return;
 
-		// initialize
 		_init();
-		_curl = curl_easy_init();
-#ifdef USE_CURL_FORM
-		curl_httppost* post = nullptr;
-		curl_httppost* last = nullptr;
-#else
-		curl_mime* mime = nullptr;
-		curl_mimepart* part = nullptr;
+		if (_multi == nullptr)
+		{
+			_multi = curl_multi_init();
+#ifdef CURLPIPE_MULTIPLEX
+			// send concurrent transfers to the same host as HTTP/2 streams over a single connection
+			curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
 #endif
+		}
+		std::map<CURL*, url_transfer_t*> active;
+		std::deque<url_transfer_t*> pending;
+		std::set<url_transfer_t*> hedging; /* started transfers with mirrors that have not completed */
+		for (auto& transfer : transfers)
+			pending.push_back(transfer.get());
+		int running = 0;
+		while (!pending.empty() || !active.empty() || !hedging.empty())
+		{
+			// start pending transfers in order, as far as the global limit and the per-host rate limiter permit
+			double wait = 1;
+			for (auto it = pending.begin(); it != pending.end() && active.size() < parallel; )
+			{
+				url_transfer_t& transfer = **it;
+				url_transfer_t& primary = transfer.primary != nullptr ? *transfer.primary : transfer;
+				if (!_host_available(transfer.host))
+				{
+					if (!primary.mirrors.empty())
+					{
+						// fail over to the mirrors right away
+						primary.hedgeat = std::chrono::steady_clock::now();
+						hedging.insert(&primary);
+					}
+					else if (hedging.count(&primary) != 0)
+					{
+						_hedge_complete(primary, active, true);
+						hedging.erase(&primary);
+					}
+					else
+					{
+						_skip(transfer);
+						_complete(transfer);
+					}
+					it = pending.erase(it);
+					continue;
+				}
+				double hostwait;
+				if (!ratelimit.try_acquire(transfer.host, hostwait))
+				{
+					wait = std::min(wait, hostwait);
+					++it;
+					continue;
+				}
+				_setup(transfer);
+				active[transfer.curl] = &transfer;
+				curl_multi_add_handle(_multi, transfer.curl);
+				it = pending.erase(it);
+				if (!primary.mirrors.empty() || hedging.count(&primary) != 0)
+				{
+					++primary.inflight;
+					primary.hedgeat = transfer.started + _hedge_delay(transfer.host);
+					hedging.insert(&primary);
+				}
+			}
+			// send slow requests also to their next mirror, these are not limited by parallel
+			for (auto it = hedging.begin(); it != hedging.end(); )
+			{
+				url_transfer_t& transfer = **it;
+				if (transfer.mirrors.empty())
+				{
+					++it;
+					continue;
+				}
+				double hedgewait = std::chrono::duration<double>(transfer.hedgeat - std::chrono::steady_clock::now()).count();
+				if (hedgewait > 0)
+				{
+					wait = std::min(wait, hedgewait);
+					++it;
+					continue;
+				}
+				std::string mirrorhost = url_host(transfer.mirrors.front());
+				if (!_host_available(mirrorhost))
+				{
+					transfer.mirrors.erase(transfer.mirrors.begin());
+					if (transfer.mirrors.empty() && transfer.inflight == 0)
+					{
+						_hedge_complete(transfer, active, true);
+						it = hedging.erase(it);
+					}
+					continue;
+				}
+				double hostwait;
+				if (!ratelimit.try_acquire(mirrorhost, hostwait))
+				{
+					wait = std::min(wait, hostwait);
+					++it;
+					continue;
+				}
+				std::unique_ptr<url_transfer_t> hedge(new url_transfer_t(transfer.mirrors.front()));
+				transfer.mirrors.erase(transfer.mirrors.begin());
+				hedge->primary = &transfer;
+				hedge->complete = transfer.complete;
+				_setup(*hedge);
+				active[hedge->curl] = hedge.get();
+				curl_multi_add_handle(_multi, hedge->curl);
+				++transfer.inflight;
+				transfer.hedgeat = hedge->started + _hedge_delay(mirrorhost);
+				transfer.hedges.emplace_back(std::move(hedge));
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					++stats.hedges;
+				}
+				++it;
+			}
+			if (active.empty())
+			{
+				if (!pending.empty() || !hedging.empty())
+					std::this_thread::sleep_for(std::chrono::duration<double>(std::max(wait, 0.001)));
+				continue;
+			}
+			CURLMcode mres = curl_multi_perform(_multi, &running);
+			// process finished transfers
+			bool finished = false;
+			int msgs;
+			CURLMsg* msg;
+			while (mres == CURLM_OK && (msg = curl_multi_info_read(_multi, &msgs)) != nullptr)
+			{
+				if (msg->msg != CURLMSG_DONE)
+					continue;
+				finished = true;
+				CURL* curl = msg->easy_handle;
+				CURLcode res = msg->data.result;
+				url_transfer_t& transfer = *active[curl];
+				active.erase(curl);
+				curl_multi_remove_handle(_multi, curl);
+				url_transfer_t& primary = transfer.primary != nullptr ? *transfer.primary : transfer;
+				bool retry = _finish(transfer, res);
+				if (hedging.count(&primary) == 0)
+				{
+					if (retry)
+						pending.push_back(&transfer);
+					else
+						_complete(transfer);
+					continue;
+				}
+				--primary.inflight;
+				// retry a throttled request only when there is nothing else to wait for
+				if (retry && primary.inflight == 0 && primary.mirrors.empty())
+				{
+					pending.push_back(&transfer);
+					continue;
+				}
+				if (!retry && _answered(transfer))
+				{
+					if (&transfer != &primary)
+					{
+						primary.header = std::move(transfer.header);
+						primary.data = std::move(transfer.data);
+						primary.status = transfer.status;
+						primary.stopped = transfer.stopped;
+						primary.stale = false;
+						std::lock_guard<std::mutex> lock(_mutex);
+						++stats.hedgewins;
+					}
+					_hedge_complete(primary, active, &transfer != &primary);
+					hedging.erase(&primary);
+				}
+				else if (primary.inflight == 0 && primary.mirrors.empty())
+				{
+					_hedge_complete(primary, active, true);
+					hedging.erase(&primary);
+				}
+				else if (!primary.mirrors.empty())
+					primary.hedgeat = std::chrono::steady_clock::now(); /* fail over right away */
+			}
+			// wait for network activity, unless finished transfers made room for pending transfers
+			if (mres == CURLM_OK && !finished)
+				mres = curl_multi_wait(_multi, nullptr, 0, std::max(1, int(wait * 1000)), nullptr);
+			if (mres != CURLM_OK)
+			{
+				std::cerr << "Error in concurrent downloads:" << std::endl << curl_multi_strerror(mres) << std::endl;
+				break;
+			}
+		}
+		// clean up transfers that did not finish
+		for (auto& ct : active)
+		{
+			curl_multi_remove_handle(_multi, ct.first);
+			url_transfer_t& transfer = *ct.second;
+			if (transfer.primary != nullptr)
+			{
+				_cancel(transfer);
+				continue;
+			}
+			_finish(transfer, CURLE_ABORTED_BY_CALLBACK);
+			if (hedging.count(&transfer) == 0)
+				_complete(transfer);
+		}
+		active.clear();
+		for (auto transfer : hedging)
+			_hedge_complete(*transfer, active, true);
+		for (auto transfer : pending)
+		{
+			if (hedging.count(transfer->primary != nullptr ? transfer->primary : transfer) != 0)
+				continue;
+			_skip(*transfer);
+			_complete(*transfer);
+		}
+	}
+
+	std::size_t maxbodysize; /* maximum response body size in bytes, 0 for unlimited */
+	double hedgedelay; /* delay in seconds before hedging requests to a host with too few known response times */
+	long connecttimeout; /* in seconds to establish a connection */
+	http_cache_t cache;
+	url_stats_t stats;
+	url_rate_limiter_t ratelimit;
+private:
+	void _init()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_initialized)
+			return;
+		curl_global_init(CURL_GLOBAL_DEFAULT);
+		_initialized = true;
+
+		_share = curl_share_init();
+		curl_share_setopt(_share, CURLSHOPT_LOCKFUNC, _share_lock);
+		curl_share_setopt(_share, CURLSHOPT_UNLOCKFUNC, _share_unlock);
+		curl_share_setopt(_share, CURLSHOPT_USERDATA, this);
+		curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		// the connection cache is not shared: libcurl does not support sharing it between handles
+		// that are used concurrently from several threads, e.g., by the background version check
+	}
+
+	// the share object may be used from several threads, libcurl asks to lock each type of shared data separately
+	static void _share_lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr)
+	{
+		static_cast<url_get_t*>(userptr)->_sharemutex[data % CURL_LOCK_DATA_LAST].lock();
+	}
+	static void _share_unlock(CURL*, curl_lock_data data, void* userptr)
+	{
+		static_cast<url_get_t*>(userptr)->_sharemutex[data % CURL_LOCK_DATA_LAST].unlock();
+	}
+
+	// take an idle easy handle for host from the pool, or create a new one
+	// curl_easy_reset clears all options, but keeps the live connections of the handle,
+	// DNS entries and TLS sessions are kept in the share object
+	CURL* _acquire(const std::string& host)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::vector<CURL*>& idle = _pool[host];
+		if (idle.empty())
+			return curl_easy_init();
+		CURL* curl = idle.back();
+		idle.pop_back();
+		curl_easy_reset(curl);
+		return curl;
+	}
+	void _release(const std::string& host, CURL* curl)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pool[host].push_back(curl);
+	}
+
+	// request coalescing: returns _COMPLETED with ret set if the request completed before or in another thread
+	// otherwise the request is registered as in flight and the caller must call _complete
+	// with ret == nullptr it does not wait for transfers in other threads and returns _INFLIGHT instead
+	enum { _REGISTERED, _COMPLETED, _INFLIGHT };
+	int _join(const std::string& key, std::pair<std::string,std::string>* ret)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (true)
+		{
+			auto it = _responses.find(key);
+			if (it != _responses.end())
+			{
+				if (ret != nullptr)
+					*ret = it->second;
+				return _COMPLETED;
+			}
+			if (_inflight.count(key) == 0)
+				break;
+			if (ret == nullptr)
+				return _INFLIGHT;
+			_inflightcv.wait(lock);
+		}
+		_inflight.insert(key);
+		return _REGISTERED;
+	}
+	std::pair<std::string,std::string> _complete(url_transfer_t& transfer)
+	{
+		std::pair<std::string,std::string> ret(std::move(transfer.header), std::move(transfer.data));
+		// failed responses are not kept, so that a later request for the same url is retried
+		long status = http_response_code(ret.first);
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!ret.first.empty() && status < 500 && status != 429)
+			_responses[transfer.key] = ret;
+		_inflight.erase(transfer.key);
+		_inflightcv.notify_all();
+		return ret;
+	}
+
+	std::pair<std::string,std::string> _get(url_transfer_t& transfer)
+	{
+		std::pair<std::string,std::string> ret;
+		if (_join(transfer.key, &ret) == _COMPLETED)
+			return ret;
+		if (!_cache_lookup(transfer))
+			_perform(transfer);
+		return _complete(transfer);
+	}
+
+	void _perform(url_transfer_t& transfer)
+	{
+		_init();
+		if (!_host_available(transfer.host))
+		{
+			_skip(transfer);
+			return;
+		}
+		while (true)
+		{
+			ratelimit.acquire(transfer.host);
+			_setup(transfer);
+			// execute request
+			CURLcode _res = curl_easy_perform(transfer.curl);
+			if (!_finish(transfer, _res))
+				break;
+		}
+	}
+
+	// errors that indicate that the host or the network is unreachable, a slow transfer does not:
+	// failures to resolve or connect, and timeouts before a connection or a response, e.g., when packets are dropped
+	static bool _is_connect_error(CURL* curl, CURLcode res)
+	{
+		if (res == CURLE_COULDNT_RESOLVE_HOST || res == CURLE_COULDNT_RESOLVE_PROXY || res == CURLE_COULDNT_CONNECT)
+			return true;
+		if (res != CURLE_OPERATION_TIMEDOUT)
+			return false;
+		double connecttime = 0;
+		long status = 0;
+		curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connecttime);
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		return connecttime == 0 || status == 0;
+	}
+
+	// circuit breaker: counts consecutive connect failures of host, and marks it down after maxfailures of them
+	void _host_result(const std::string& host, bool connecterror)
+	{
+		const unsigned maxfailures = 3;
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!connecterror)
+		{
+			_connectfailures.erase(host);
+			return;
+		}
+		if (++_connectfailures[host] < maxfailures || _hostdown.count(host) != 0)
+			return;
+		_hostdown[host] = std::chrono::steady_clock::now() + _probecooldown();
+		std::cerr << "Host '" << host << "' is unreachable, skipping its requests for " << _probecooldown().count() << "s." << std::endl;
+	}
+	static std::chrono::seconds _probecooldown() { return std::chrono::seconds(30); }
+
+	// circuit breaker: returns false if host is down, after a cooldown one request probes whether it is reachable again
+	bool _host_available(const std::string& host)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto it = _hostdown.find(host);
+			if (it == _hostdown.end())
+				return true;
+			if (std::chrono::steady_clock::now() < it->second)
+				return false;
+			// other requests keep skipping host while this one probes
+			it->second = std::chrono::steady_clock::now() + _probecooldown();
+		}
+		// probe by only connecting to the host
+		CURL* curl = curl_easy_init();
+		curl_easy_setopt(curl, CURLOPT_SHARE, _share);
+		curl_easy_setopt(curl, CURLOPT_URL, (host + "/").c_str());
+		curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 1L);
+		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 3L);
+		CURLcode res = curl_easy_perform(curl);
+		curl_easy_cleanup(curl);
+		if (res != CURLE_OK)
+			return false;
+		std::cout << "Host '" << host << "' is reachable again." << std::endl;
+		std::lock_guard<std::mutex> lock(_mutex);
+		_hostdown.erase(host);
+		_connectfailures.erase(host);
+		return true;
+	}
+
+	// complete transfer without network access
+	void _skip(url_transfer_t& transfer)
+	{
+		std::cerr << "Skipped URL '" << transfer.url << "': host is unreachable" << std::endl;
+		transfer.header.clear();
+		transfer.data.clear();
+		_cache_update(transfer);
+	}
+
+	// returns true if transfer has been completed with a fresh cache entry
+	// otherwise a stale cache entry is kept in transfer for revalidation
+	bool _cache_lookup(url_transfer_t& transfer)
+	{
+		if (!transfer.cacheable || !cache.load(transfer.url, transfer.cached))
+			return false;
+		// a partial body can only be used by requests for which it is complete
+		if (transfer.cached.partial)
+		{
+			url_complete_t complete = transfer.complete;
+			if (!complete || !complete(transfer.cached.body))
+				return false;
+		}
+		transfer.havecached = true;
+		if (!cache.is_fresh(transfer.cached))
+			return false;
+		transfer.header = "HTTP/1.1 200 OK\r\nX-Cache: HIT\r\n\r\n";
+		transfer.data = transfer.cached.body;
+		return true;
+	}
+
+	// store successful responses in the cache and complete revalidated (or failed) transfers with the cached body
+	void _cache_update(url_transfer_t& transfer)
+	{
+		if (!transfer.cacheable || !cache.enabled())
+			return;
+		if (transfer.header.empty())
+		{
+			if (!transfer.havecached)
+				return;
+			std::cerr << "Using stale cached copy of URL '" << transfer.url << "'" << std::endl;
+			transfer.header = "HTTP/1.1 200 OK\r\nX-Cache: STALE\r\n\r\n";
+			transfer.data = transfer.cached.body;
+			transfer.stale = true;
+			return;
+		}
+		if (transfer.status == 304 && transfer.havecached)
+		{
+			transfer.cached.time = std::time(nullptr);
+			cache.store(transfer.cached);
+			transfer.data = transfer.cached.body;
+			return;
+		}
+		if (transfer.status != 200 || transfer.toolarge)
+			return;
+		http_cache_entry_t entry;
+		entry.url = transfer.url;
+		// the body of a transfer stopped early is partial, it is not revalidated but retrieved again when stale
+		entry.partial = transfer.stopped;
+		if (!entry.partial)
+		{
+			entry.etag = http_header_value(transfer.header, "ETag");
+			entry.lastmodified = http_header_value(transfer.header, "Last-Modified");
+		}
+		entry.time = std::time(nullptr);
+		entry.body = transfer.data;
+		cache.store(entry);
+	}
 
+	// acquire easy handle and set up request
+	void _setup(url_transfer_t& transfer)
+	{
+		CURL* _curl = transfer.curl = _acquire(transfer.host);
+		transfer.maxbodysize = maxbodysize;
+		transfer.completecheck = transfer.complete;
+		transfer.started = std::chrono::steady_clock::now();
 #ifdef GET_URL_DEBUG
 		curl_easy_setopt(_curl, CURLOPT_VERBOSE, 1L);
 #endif
-		// set up request
-		curl_easy_setopt(_curl, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(_curl, CURLOPT_SHARE, _share);
+		curl_easy_setopt(_curl, CURLOPT_URL, transfer.url.c_str());
 		curl_easy_setopt(_curl, CURLOPT_HEADERFUNCTION, _curl_header_callback);
-		curl_easy_setopt(_curl, CURLOPT_HEADERDATA, &_header);
+		curl_easy_setopt(_curl, CURLOPT_HEADERDATA, &transfer.header);
 		curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, _curl_write_callback);
-		curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &_data);
+		curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &transfer);
+		curl_easy_setopt(_curl, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(_curl, CURLOPT_CONNECTTIMEOUT, connecttimeout);
+		if (transfer.timeout > 0)
+			curl_easy_setopt(_curl, CURLOPT_TIMEOUT, transfer.timeout);
+		// request all content encodings supported by libcurl (gzip, deflate, brotli, zstd), decoded transparently
+		curl_easy_setopt(_curl, CURLOPT_ACCEPT_ENCODING, "");
+#if LIBCURL_VERSION_NUM >= 0x072f00
+		// negotiate HTTP/2 over TLS, and let concurrent transfers wait for a connection they can multiplex on
+		curl_easy_setopt(_curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+		curl_easy_setopt(_curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+
+		// conditional request to revalidate a stale cache entry
+		if (transfer.havecached)
+		{
+			if (!transfer.cached.etag.empty())
+				transfer.headers = curl_slist_append(transfer.headers, ("If-None-Match: " + transfer.cached.etag).c_str());
+			if (!transfer.cached.lastmodified.empty())
+				transfer.headers = curl_slist_append(transfer.headers, ("If-Modified-Since: " + transfer.cached.lastmodified).c_str());
+			curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, transfer.headers);
+		}
 
 		// process postdata fields
-		if (!postdata.empty())
+		if (!transfer.postdata.empty())
 		{
 #ifdef USE_CURL_FORM
-			for (auto& pd : postdata)
+			curl_httppost* last = nullptr;
+			for (auto& pd : transfer.postdata)
 			{
-				curl_formadd(&post, &last, CURLFORM_COPYNAME, pd.first.data(), CURLFORM_COPYCONTENTS, pd.second.data(), CURLFORM_END);
+				curl_formadd(&transfer.post, &last, CURLFORM_COPYNAME, pd.first.data(), CURLFORM_COPYCONTENTS, pd.second.data(), CURLFORM_END);
 #ifdef GET_URL_DEBUG
 				std::cerr << "POSTDATA:" << pd.first << ":" << pd.second << std::endl;
 #endif
 			}
-			curl_easy_setopt(_curl, CURLOPT_HTTPPOST, post);
+			curl_easy_setopt(_curl, CURLOPT_HTTPPOST, transfer.post);
 #else
-			mime = curl_mime_init(_curl);
-			for (auto& pd : postdata)
+			curl_mimepart* part = nullptr;
+			transfer.mime = curl_mime_init(_curl);
+			for (auto& pd : transfer.postdata)
 			{
 #ifdef GET_URL_DEBUG
 				std::cerr << "POSTDATA:" << pd.first << ":" << pd.second << std::endl;
 #endif
-				part = curl_mime_addpart(mime);
+				part = curl_mime_addpart(transfer.mime);
 				curl_mime_type(part, "multipart/form-data");
 				curl_mime_name(part, pd.first.c_str());
 				curl_mime_data(part, pd.second.c_str(), pd.second.size());
 			}
-			part = curl_mime_addpart(mime);
-			curl_easy_setopt(_curl, CURLOPT_MIMEPOST, mime);
+			part = curl_mime_addpart(transfer.mime);
+			curl_easy_setopt(_curl, CURLOPT_MIMEPOST, transfer.mime);
 #endif
 		}
+	}
+
+	// number of seconds to wait before retrying a throttled request: from Retry-After, or exponential backoff
+	static double _retry_after(const std::string& header, unsigned attempts)
+	{
+		std::string retryafter = http_header_value(header, "Retry-After");
+		if (!retryafter.empty() && retryafter.find_first_not_of("0123456789") == std::string::npos)
+			return std::stod(retryafter);
+		if (!retryafter.empty())
+		{
+			time_t date = curl_getdate(retryafter.c_str(), nullptr);
+			if (date != -1)
+				return std::max(0.0, std::difftime(date, std::time(nullptr)));
+		}
+		return double(1u << std::min(attempts, 5u));
+	}
+
+	// updates the rate limiter with the result of transfer and returns true if a throttled transfer must be retried
+	bool _throttled(url_transfer_t& transfer)
+	{
+		const unsigned maxattempts = 4;
+		const double maxretryafter = 60;
+		bool throttled = transfer.status == 429
+			|| (transfer.status == 503 && !http_header_value(transfer.header, "Retry-After").empty());
+		double retryafter = throttled ? _retry_after(transfer.header, transfer.attempts) : 0;
+		ratelimit.release(transfer.host, throttled, retryafter);
+		if (!throttled)
+			return false;
+		if (++transfer.attempts >= maxattempts || retryafter > maxretryafter)
+		{
+			std::cerr << "Throttled by '" << transfer.host << "', giving up on URL '" << transfer.url << "'" << std::endl;
+			// fail like a network error, so that a stale cached copy is used and callers do not see the error page
+			transfer.header.clear();
+			transfer.data.clear();
+			return false;
+		}
+		std::cerr << "Throttled by '" << transfer.host << "', retrying URL '" << transfer.url << "' in " << retryafter << "s" << std::endl;
+		transfer.header.clear();
+		transfer.data.clear();
+		transfer.status = 0;
+		transfer.reserved = transfer.stopped = false;
+		return true;
+	}
 
-		// execute request and return results
-		CURLcode _res = curl_easy_perform(_curl);
-		curl_easy_cleanup(_curl);
+	// account transfer in the statistics, and release its easy handle and request headers and data
+	void _release_transfer(url_transfer_t& transfer, std::size_t bodybytes)
+	{
+#if LIBCURL_VERSION_NUM >= 0x073700
+		curl_off_t sizedownload = 0;
+		curl_easy_getinfo(transfer.curl, CURLINFO_SIZE_DOWNLOAD_T, &sizedownload);
+#else
+		double sizedownload = 0;
+		curl_easy_getinfo(transfer.curl, CURLINFO_SIZE_DOWNLOAD, &sizedownload);
+#endif
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			++stats.requests;
+			stats.wirebytes += (unsigned long long)(sizedownload);
+			stats.bodybytes += bodybytes;
+		}
+		_release(transfer.host, transfer.curl);
+		transfer.curl = nullptr;
+		if (transfer.headers != nullptr)
+			curl_slist_free_all(transfer.headers);
+		transfer.headers = nullptr;
 #ifdef USE_CURL_FORM
-		if (post != nullptr)
-			curl_formfree(post);
+		if (transfer.post != nullptr)
+			curl_formfree(transfer.post);
+		transfer.post = nullptr;
 #else
-		if (mime != nullptr)
-			curl_mime_free(mime);
+		if (transfer.mime != nullptr)
+			curl_mime_free(transfer.mime);
+		transfer.mime = nullptr;
 #endif
+	}
+
+	// stop an active transfer whose response is not needed anymore, keeps its header and data
+	void _cancel(url_transfer_t& transfer)
+	{
+		_release_transfer(transfer, 0);
+		ratelimit.release(transfer.host, false, 0);
+	}
+
+	// a response that makes requests to other mirrors unnecessary, a stale cached copy is only used when no mirror answers
+	static bool _answered(const url_transfer_t& transfer)
+	{
+		return !transfer.header.empty() && !transfer.stale && url_answered(transfer.status, transfer.havecached);
+	}
+
+	// hedging delay for host: the 95th percentile of its recent response times
+	std::chrono::steady_clock::duration _hedge_delay(const std::string& host)
+	{
+		const std::size_t minsamples = 8;
+		std::lock_guard<std::mutex> lock(_mutex);
+		double delay = hedgedelay;
+		auto it = _responsetimes.find(host);
+		if (it != _responsetimes.end() && it->second.size() >= minsamples)
+		{
+			std::vector<double> times(it->second.begin(), it->second.end());
+			auto p95 = times.begin() + std::min(times.size() - 1, times.size() * 95 / 100);
+			std::nth_element(times.begin(), p95, times.end());
+			delay = *p95;
+		}
+		return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(delay));
+	}
+	void _add_response_time(const std::string& host, double seconds)
+	{
+		const std::size_t maxsamples = 100;
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::deque<double>& times = _responsetimes[host];
+		times.push_back(seconds);
+		if (times.size() > maxsamples)
+			times.pop_front();
+	}
+
+	// complete a hedged request, its transfers that are still active are cancelled
+	// with update the response is stored in the cache, which the winning transfer has not done yet
+	void _hedge_complete(url_transfer_t& primary, std::map<CURL*, url_transfer_t*>& active, bool update)
+	{
+		for (auto it = active.begin(); it != active.end(); )
+		{
+			url_transfer_t& transfer = *it->second;
+			if (&transfer != &primary && transfer.primary != &primary)
+			{
+				++it;
+				continue;
+			}
+			curl_multi_remove_handle(_multi, it->first);
+			_cancel(transfer);
+			it = active.erase(it);
+		}
+		primary.inflight = 0;
+		if (update)
+			_cache_update(primary);
+		_complete(primary);
+	}
+
+	// release easy handle and process result, returns true if the transfer must be retried
+	bool _finish(url_transfer_t& transfer, CURLcode _res)
+	{
+		curl_easy_getinfo(transfer.curl, CURLINFO_RESPONSE_CODE, &transfer.status);
+		const bool connecterror = _is_connect_error(transfer.curl, _res);
+		_release_transfer(transfer, transfer.data.size());
 
 #ifdef GET_URL_DEBUG
 		std::cerr
-			<< "url_get::url=" << url << std::endl
+			<< "url_get::url=" << transfer.url << std::endl
 			<< "url_get::_res=" << _res << std::endl
-			<< "url_get::_header=:" << std::endl << _header << std::endl
-			<< "url_get::_data=:" << std::endl << _data << std::endl
+			<< "url_get::_header=:" << std::endl << transfer.header << std::endl
+			<< "url_get::_data=:" << std::endl << transfer.data << std::endl
 			<< "url_get::end" << std::endl;
 #endif
 
+		// a transfer stopped by the write callback once its data was complete succeeded
+		if (_res == CURLE_WRITE_ERROR && transfer.stopped)
+			_res = CURLE_OK;
 		if (_res != CURLE_OK)
 		{
-			std::cerr << "Error in retrieving URL '" << url << "':" << std::endl << curl_easy_strerror(_res) << std::endl;
-			_header.clear();
-			_data.clear();
+			if (transfer.toolarge)
+				std::cerr << "Error in retrieving URL '" << transfer.url << "':" << std::endl << "response exceeds " << transfer.maxbodysize << " bytes" << std::endl;
+			else
+				std::cerr << "Error in retrieving URL '" << transfer.url << "':" << std::endl << curl_easy_strerror(_res) << std::endl;
+			transfer.header.clear();
+			transfer.data.clear();
 		}
-		_havesuccess = true;
-		return std::pair<std::string,std::string>(_header,_data);
+		else if (_answered(transfer))
+			_add_response_time(transfer.host, std::chrono::duration<double>(std::chrono::steady_clock::now() - transfer.started).count());
+		_host_result(transfer.host, connecterror);
+		if (_throttled(transfer))
+			return true;
+		_cache_update(transfer);
+		return false;
 	}
 
-	bool _havesuccess;
-private:
-	void _init()
-	{
-		if (_curl == nullptr)
-			return;
-		curl_global_init(CURL_GLOBAL_DEFAULT);
-	}
-
-	CURL* _curl;
+	std::mutex _mutex; /* protects the members below against concurrent use from several threads */
+	bool _initialized;
+	CURLSH* _share;
+	std::mutex _sharemutex[CURL_LOCK_DATA_LAST];
+	std::map<std::string, std::vector<CURL*>> _pool; /* per host: idle easy handles */
+	CURLM* _multi;
+	std::map<std::string, std::chrono::steady_clock::time_point> _hostdown; /* hosts marked down by the circuit breaker => time of next probe */
+	std::map<std::string, unsigned> _connectfailures; /* per host: number of consecutive connect failures */
+	std::map<std::string, std::pair<std::string,std::string>> _responses; /* request key => (header, data) of successfully completed requests */
+	std::set<std::string> _inflight; /* request keys of transfers in progress */
+	std::condition_variable _inflightcv; /* signals completion of transfers in progress */
+	std::map<std::string, std::deque<double>> _responsetimes; /* per host: recent response times in seconds */
 };
 url_get_t url_get;
 
 
 /*** check for new version ***/
-void check_new_version()
+// returns the latest version number from the project page, or an empty string on failure
+// uses its own easy handle instead of url_get, so that it can run in a thread that outlives url_get
+std::string get_latest_version()
 {
-	std::string html = url_get("https://raw.githubusercontent.com/cr-marcstevens/dblpbibtex/master/version.txt").second;
+	std::string html;
+	CURL* curl = curl_easy_init();
+	if (curl == nullptr)
+		return std::string();
+	curl_easy_setopt(curl, CURLOPT_URL, "https://raw.githubusercontent.com/cr-marcstevens/dblpbibtex/master/version.txt");
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _curl_header_callback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &html);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
+	CURLcode res = curl_easy_perform(curl);
+	long status = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	curl_easy_cleanup(curl);
+	if (res != CURLE_OK || status != 200 || html.find("VERSION:") == std::string::npos)
+		return std::string();
 	std::string version = html.substr(html.find("VERSION:")+8);
-	html.erase(html.find_first_not_of(".0123456789"));
+	version.erase(std::min(version.find_first_not_of(".0123456789"), version.size()));
+	return version;
+}
+
+// result of the new version check, shared with the background thread that retrieves it
+struct new_version_check_t {
+	new_version_check_t()
+		: ready(false)
+	{
+	}
+	std::mutex mutex;
+	std::condition_variable readycv;
+	bool ready;
+	std::string version;
+};
+typedef std::shared_ptr<new_version_check_t> new_version_t;
+
+// usage: auto newversion = start_new_version_check(cachedir); ... report_new_version(newversion);
+// the latest version, or the failure to retrieve it, is cached in cachedir for a day,
+// when that is stale it is retrieved in a detached thread, which the end of the run does not wait for
+new_version_t start_new_version_check(const std::string& cachedir)
+{
+	new_version_t check = std::make_shared<new_version_check_t>();
+	std::string filename = cachedir.empty() ? std::string() : (fs::path(cachedir) / "version.txt").string();
+	std::string content;
+	if (read_file(filename, content) && content.find(' ') != std::string::npos)
+	{
+		// cache file contains 'time version', with an empty version when the check failed
+		std::time_t checktime = 0;
+		try { checktime = std::time_t(std::stoll(content.substr(0, content.find(' ')))); } catch (...) {}
+		if (std::time(nullptr) - checktime < 24 * 60 * 60)
+		{
+			check->version = sa::trim_copy(content.substr(content.find(' ') + 1));
+			check->ready = true;
+			return check;
+		}
+	}
+	// this reference to libcurl is never released, so that the clean up of url_get at exit keeps it initialized
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	std::thread([check, filename]()
+		{
+			std::string version = get_latest_version();
+			// failures are cached too, so that offline runs do not retry on every run
+			if (!filename.empty())
+			{
+				try { fs::create_directories(fs::path(filename).parent_path()); } catch (...) {}
+				atomic_write_file(filename, std::to_string((long long)std::time(nullptr)) + " " + version + "\n");
+			}
+			std::lock_guard<std::mutex> lock(check->mutex);
+			check->version = version;
+			check->ready = true;
+			check->readycv.notify_all();
+		}).detach();
+	return check;
+}
+
+// the result is dropped when it is not ready shortly, the background request is limited by a timeout
+void report_new_version(const new_version_t& newversion)
+{
+	if (!newversion)
+		return;
+	std::string version;
+	{
+		std::unique_lock<std::mutex> lock(newversion->mutex);
+		if (!newversion->readycv.wait_for(lock, std::chrono::milliseconds(500), [&]() { return newversion->ready; }))
+			return;
+		version = newversion->version;
+	}
 	if (version == "")
 		std::cout << "New version check failed!" << std::endl;
 	else if (version != DBLPBIBTEX_VERSION)
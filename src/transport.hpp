@@ -0,0 +1,360 @@
+//          Copyright Marc Stevens 2010 - 2019.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBLPBIBTEX_TRANSPORT_HPP
+#define DBLPBIBTEX_TRANSPORT_HPP
+
+#include "core.hpp"
+#include "cache.hpp"
+#include "network.hpp"
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+/*** recorded request/response pairs ***/
+
+typedef std::pair<std::string,std::string> url_response_t; /* (header string, data string) */
+
+// fixture file format: a version line, followed by records of three length-prefixed fields
+//     dblpbibtex-fixture 1
+//     key <length>\n<request key>\n
+//     header <length>\n<response header>\n
+//     data <length>\n<response data>\n
+class url_fixture_t {
+public:
+	bool load(const std::string& filename)
+	{
+		_responses.clear();
+		std::ifstream ifs(filename.c_str(), std::ios::binary);
+		if (!ifs)
+			return false;
+		std::string content = read_istream(ifs);
+		std::string::size_type pos = 0;
+		std::string version;
+		if (!_read_line(content, pos, version) || version != "dblpbibtex-fixture 1")
+			return false;
+		while (pos < content.size())
+		{
+			std::string key, header, data;
+			if (!_read_field(content, pos, "key", key)
+				|| !_read_field(content, pos, "header", header)
+				|| !_read_field(content, pos, "data", data))
+			{
+				std::cerr << "Fixture file '" << filename << "' is corrupt after " << _responses.size() << " responses" << std::endl;
+				return false;
+			}
+			_responses[key] = url_response_t(header, data);
+		}
+		return true;
+	}
+
+	bool save(const std::string& filename) const
+	{
+		std::string content = "dblpbibtex-fixture 1\n";
+		for (auto& kr : _responses)
+		{
+			content += "key " + std::to_string(kr.first.size()) + "\n" + kr.first + "\n";
+			content += "header " + std::to_string(kr.second.first.size()) + "\n" + kr.second.first + "\n";
+			content += "data " + std::to_string(kr.second.second.size()) + "\n" + kr.second.second + "\n";
+		}
+		return atomic_write_file(filename, content);
+	}
+
+	bool find(const std::string& key, url_response_t& response) const
+	{
+		auto it = _responses.find(key);
+		if (it == _responses.end())
+			return false;
+		response = it->second;
+		return true;
+	}
+	void insert(const std::string& key, const url_response_t& response)
+	{
+		_responses[key] = response;
+	}
+	std::size_t size() const { return _responses.size(); }
+
+private:
+	static bool _read_line(const std::string& content, std::string::size_type& pos, std::string& line)
+	{
+		std::string::size_type eol = content.find('\n', pos);
+		if (eol == std::string::npos)
+			return false;
+		line = content.substr(pos, eol - pos);
+		pos = eol + 1;
+		return true;
+	}
+	static bool _read_field(const std::string& content, std::string::size_type& pos, const std::string& name, std::string& value)
+	{
+		std::string line;
+		if (!_read_line(content, pos, line) || !sa::starts_with(line, name + " "))
+			return false;
+		std::size_t length = 0;
+		try {
+			length = std::stoul(line.substr(name.size() + 1));
+		} catch (...) {
+			return false;
+		}
+		if (content.size() - pos < length + 1 || content[pos + length] != '\n')
+			return false;
+		value = content.substr(pos, length);
+		pos += length + 1;
+		return true;
+	}
+
+	std::map<std::string, url_response_t> _responses; /* request key => response */
+};
+
+/*** record and replay transports ***/
+
+// usage: url_record.open(fixturefile, backend) forwards all requests to backend and records their responses,
+// url_record.save() writes them to fixturefile, which is extended when it already exists
+// responses of failed requests (empty header) are not recorded
+class url_record_t
+	: public url_transport_t
+{
+public:
+	url_record_t()
+		: _backend(nullptr)
+	{
+	}
+
+	bool open(const std::string& filename, url_transport_t& backend)
+	{
+		_filename = filename;
+		_backend = &backend;
+		if (fs::exists(filename) && !_fixture.load(filename))
+		{
+			std::cerr << "Cannot load fixture file '" << filename << "'" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool save()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_fixture.save(_filename))
+		{
+			std::cerr << "Cannot save fixture file '" << _filename << "'" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	url_response_t get(const std::string& url, const url_postdata_t& postdata = url_postdata_t()) override
+	{
+		return _record(url_request_key(url, postdata), _backend->get(url, postdata));
+	}
+
+	url_response_t get_cached(const url_request_t& request) override
+	{
+		return _record(url_request_key(request.url), _backend->get_cached(request));
+	}
+
+	void prefetch(const std::vector<url_request_t>& requests, unsigned parallel) override
+	{
+		_backend->prefetch(requests, parallel);
+		// the backend coalesces these with the prefetched responses
+		for (auto& request : requests)
+			get_cached(request);
+	}
+
+private:
+	url_response_t _record(const std::string& key, const url_response_t& response)
+	{
+		if (!response.first.empty())
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_fixture.insert(key, response);
+		}
+		return response;
+	}
+
+	std::mutex _mutex;
+	std::string _filename;
+	url_transport_t* _backend;
+	url_fixture_t _fixture;
+};
+
+// usage: url_replay.open(fixturefile, latency) serves the recorded responses in fixturefile without network access
+// every response that is not prefetched takes latency seconds, or hostlatency[host] for urls on host,
+// prefetch(requests, parallel) takes as long as downloading the requests parallel at a time,
+// so download pipelines can be measured deterministically
+// requests with mirrors are hedged by a model of the schedule of url_get, mirrors without recorded response are not tried,
+// the hedging of url_get itself is tested by test_network.sh
+// requests without recorded response fail like a network error
+class url_replay_t
+	: public url_transport_t
+{
+public:
+	url_replay_t()
+		: replayed(0), missing(0), hedges(0), hedgewins(0), hedgedelay(1), _latency(0)
+	{
+	}
+
+	bool open(const std::string& filename, double latency)
+	{
+		_latency = latency;
+		if (!_fixture.load(filename))
+		{
+			std::cerr << "Cannot load fixture file '" << filename << "'" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	url_response_t get(const std::string& url, const url_postdata_t& postdata = url_postdata_t()) override
+	{
+		std::string key = url_request_key(url, postdata);
+		url_response_t response;
+		bool found = _fixture.find(key, response);
+		_count(url, found);
+		if (!_prefetched(key))
+			_sleep(_host_latency(url));
+		return response;
+	}
+
+	url_response_t get_cached(const url_request_t& request) override
+	{
+		url_response_t response;
+		double seconds = _hedge(request, response, true);
+		if (!_prefetched(url_request_key(request.url)))
+			_sleep(seconds);
+		return response;
+	}
+
+	void prefetch(const std::vector<url_request_t>& requests, unsigned parallel) override
+	{
+		// each request is downloaded in the first slot that becomes free
+		std::vector<double> slots(std::max(parallel, 1u), 0.0);
+		for (auto& request : requests)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (!_prefetchedkeys.insert(url_request_key(request.url)).second)
+					continue;
+			}
+			url_response_t response;
+			*std::min_element(slots.begin(), slots.end()) += _hedge(request, response, false);
+		}
+		_sleep(*std::max_element(slots.begin(), slots.end()));
+	}
+
+	unsigned replayed; /* number of responses served */
+	unsigned missing; /* number of requests without recorded response */
+	unsigned hedges; /* hedged requests sent to mirrors */
+	unsigned hedgewins; /* hedged requests that answered first */
+	double hedgedelay; /* delay in seconds before a request is also sent to the next mirror */
+	std::map<std::string, double> hostlatency; /* per host: latency in seconds that replaces latency */
+
+private:
+	// replays request like url_get sends it: the next mirror is tried when no response has answered within hedgedelay
+	// seconds after the previous request was sent, or right away when a response does not answer,
+	// the first answer is used, otherwise the response of the primary url
+	// returns the simulated seconds until the first answer, or until the last response when none answers
+	double _hedge(const url_request_t& request, url_response_t& response, bool count)
+	{
+		std::vector<std::string> urls(1, request.url);
+		urls.insert(urls.end(), request.mirrors.begin(), request.mirrors.end());
+		double sent = 0, answered = -1, last = 0;
+		std::vector<double> failed; /* times of responses that did not answer */
+		std::size_t winner = 0;
+		for (std::size_t i = 0; i < urls.size(); ++i)
+		{
+			url_response_t mirrorresponse;
+			bool found = _fixture.find(url_request_key(urls[i]), mirrorresponse);
+			if (i != 0)
+			{
+				if (!found)
+					continue;
+				double next = sent + hedgedelay;
+				for (double t : failed)
+					if (t >= sent)
+						next = std::min(next, t);
+				if (answered >= 0 && answered <= next)
+					break;
+				sent = next;
+				if (count)
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					++hedges;
+				}
+			}
+			if (count)
+				_count(urls[i], found);
+			double at = sent + _host_latency(urls[i]);
+			last = std::max(last, at);
+			if (found && url_answered(http_response_code(mirrorresponse.first), false))
+			{
+				if (answered < 0 || at < answered)
+				{
+					answered = at;
+					winner = i;
+					response = mirrorresponse;
+				}
+			}
+			else
+			{
+				failed.push_back(at);
+				if (i == 0)
+					response = mirrorresponse;
+			}
+		}
+		if (count && winner != 0)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			++hedgewins;
+		}
+		return answered >= 0 ? answered : last;
+	}
+
+	void _count(const std::string& url, bool found)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			++(found ? replayed : missing);
+		}
+		if (!found)
+			std::cerr << "Error in retrieving URL '" << url << "':" << std::endl << "no recorded response" << std::endl;
+	}
+
+	bool _prefetched(const std::string& key)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _prefetchedkeys.count(key) != 0;
+	}
+
+	double _host_latency(const std::string& url) const
+	{
+		auto it = hostlatency.find(url_host(url));
+		return it != hostlatency.end() ? it->second : _latency;
+	}
+
+	static void _sleep(double seconds)
+	{
+		if (seconds > 0)
+			std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	}
+
+	std::mutex _mutex;
+	double _latency;
+	url_fixture_t _fixture;
+	std::set<std::string> _prefetchedkeys; /* request keys of which the latency has been spent in prefetch */
+};
+
+url_record_t url_record;
+url_replay_t url_replay;
+url_transport_t* url_transport = &url_get; /* transport used to retrieve citations and search results */
+
+#endif // DBLPBIBTEX_TRANSPORT_HPP
@@ -0,0 +1,98 @@
+#!/bin/bash
+# tests the network download path against stand-in DBLP servers on 127.0.0.1, started from test_network_server.py
+
+SERVER=$(pwd)/test_network_server.py
+PORT=18731
+
+rm -rf tmpnetwork &>/dev/null
+mkdir tmpnetwork
+cd tmpnetwork
+
+SERVERPIDS=""
+function stop_servers
+{
+	for pid in $SERVERPIDS; do
+		kill $pid &>/dev/null
+	done
+}
+trap stop_servers EXIT
+# usage: start_server port [delay | blackhole]
+function start_server
+{
+	python3 $SERVER $* &
+	SERVERPIDS="$SERVERPIDS $!"
+}
+
+function cleanup
+{
+	rm -rf *.bib *.aux dblpbibtex.cfg cache &>/dev/null
+}
+function make_aux_file
+{
+while [ "$1" != "" ]; do
+	echo "\citation{$1}" >> test.aux
+	shift 1
+done
+echo "\bibdata{test}" >> test.aux
+}
+
+# usage: test_network "extra dblpbibtex.cfg lines" citations...
+# keeps the download cache of the previous call
+function test_network
+{
+rm -rf *.bib *.aux dblpbibtex.cfg &>/dev/null
+echo "bibtex=true" > dblpbibtex.cfg
+echo "nonewversioncheck=true" >> dblpbibtex.cfg
+echo "cachedir=cache" >> dblpbibtex.cfg
+echo -e "$1" >> dblpbibtex.cfg
+shift 1
+make_aux_file $*
+touch test.bib
+
+../dblpbibtex test &> dblpbibtex.log
+echo "=== test.bib ==="
+cat test.bib
+echo "================"
+}
+
+BLACKHOLE=$PORT
+FAST=$((PORT+1))
+SLOW=$((PORT+2))
+start_server $BLACKHOLE blackhole
+start_server $FAST
+start_server $SLOW 3
+sleep 1
+
+# a host that drops connection attempts is skipped after 3 connect timeouts
+cleanup
+test_network "dblpmirror=http://127.0.0.1:$BLACKHOLE\nconnecttimeout=1" "DBLP:conf/test/A17" "DBLP:conf/test/B17" "DBLP:conf/test/C17" "DBLP:conf/test/D17"
+if [ `grep "Host 'http://127.0.0.1:$BLACKHOLE' is unreachable" dblpbibtex.log | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "Skipped URL 'http://127.0.0.1:$BLACKHOLE/" dblpbibtex.log | wc -l` -eq 0 ]; then echo "! Failed !"; exit 1; fi
+# a DBLP venue export revalidated with 304 Not Modified is used from the cache
+VENUE="DBLP:conf/test/Venue17 DBLP:conf/test/Other17 DBLP:conf/test/Third17"
+cleanup
+test_network "dblpmirror=http://127.0.0.1:$FAST\ncachettl=0" $VENUE
+if [ `grep "@inproceedings{DBLP:conf/test/" test.bib | wc -l` -ne 3 ]; then echo "! Failed !"; exit 1; fi
+test_network "dblpmirror=http://127.0.0.1:$FAST\ncachettl=0" $VENUE
+if [ `grep "@inproceedings{DBLP:conf/test/" test.bib | wc -l` -ne 3 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "Downloaded DBLP venue 'conf/test' 2017: 3 bibtex entries with 3 of its 3 citations" dblpbibtex.log | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+# a corrupt download cache entry is downloaded again
+cleanup
+test_network "dblpmirror=http://127.0.0.1:$FAST" "DBLP:conf/test/A17"
+sed -i.orig "s/^time: .*/time: corrupt/" cache/http/*.cache
+rm -f cache/http/*.orig
+test_network "dblpmirror=http://127.0.0.1:$FAST" "DBLP:conf/test/A17"
+if [ `grep "@inproceedings{DBLP:conf/test/A17" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "time: corrupt" cache/http/*.cache | wc -l` -ne 0 ]; then echo "! Failed !"; exit 1; fi
+# a slow primary DBLP server is hedged to the mirror, which answers first
+cleanup
+test_network "dblpmirror=http://127.0.0.1:$SLOW\ndblpmirror=http://127.0.0.1:$FAST" "DBLP:conf/test/A17"
+if [ `grep "@inproceedings{DBLP:conf/test/A17" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "Hedged requests: 1 sent to DBLP mirrors, 1 answered first." dblpbibtex.log | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+# a fast primary DBLP server is not hedged
+cleanup
+test_network "dblpmirror=http://127.0.0.1:$FAST\ndblpmirror=http://127.0.0.1:$SLOW" "DBLP:conf/test/A17"
+if [ `grep "@inproceedings{DBLP:conf/test/A17" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "Hedged requests" dblpbibtex.log | wc -l` -ne 0 ]; then echo "! Failed !"; exit 1; fi
+
+echo "All network tests passed."
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# stand-in DBLP server for test_network.sh, serves generated bib entries on 127.0.0.1
+# usage: test_network_server.py port [delay in seconds before each response]
+#        test_network_server.py port blackhole
+# a blackhole accepts no connections and drops connection attempts, like an unreachable host
+
+import re
+import socket
+import sys
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from socketserver import ThreadingMixIn
+
+PORT = int(sys.argv[1])
+MODE = sys.argv[2] if len(sys.argv) > 2 else "0"
+
+
+def entry(key):
+	name = key.split("/")[-1]
+	return "@inproceedings{DBLP:%s,\n  author    = {Alice Author},\n  title     = {Title of %s},\n  booktitle = {Proceedings},\n  year      = {2017}\n}\n" % (key, name)
+
+
+class Handler(BaseHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+
+	def log_message(self, *args):
+		pass
+
+	def send(self, code, body=""):
+		body = body.encode()
+		etag = '"%08x"' % (sum(body) & 0xffffffff)
+		if code == 200 and self.headers.get("If-None-Match") == etag:
+			code, body = 304, b""
+		self.send_response(code)
+		self.send_header("Content-Type", "text/plain")
+		self.send_header("Content-Length", str(len(body)))
+		if code in (200, 304):
+			self.send_header("ETag", etag)
+		self.end_headers()
+		self.wfile.write(body)
+
+	def do_GET(self):
+		time.sleep(float(MODE))
+		url = urllib.parse.urlparse(self.path)
+		m = re.match(r"^/rec/(.*)\.bib$", url.path)
+		if m:
+			return self.send(200, entry(m.group(1)))
+		if url.path == "/search/publ/api":
+			m = re.search(r"stream:streams/([^:]*):", urllib.parse.parse_qs(url.query).get("q", [""])[0])
+			if m:
+				return self.send(200, "\n".join(entry(m.group(1) + "/" + name) for name in ["Venue17", "Other17", "Third17"]))
+		return self.send(404, "not found")
+
+
+class Server(ThreadingMixIn, HTTPServer):
+	daemon_threads = True
+	allow_reuse_address = True
+
+
+if MODE == "blackhole":
+	listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	listener.bind(("127.0.0.1", PORT))
+	listener.listen(0)
+	# fill the accept queue, so that further connection attempts are dropped
+	fill = []
+	for i in range(4):
+		s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		s.setblocking(False)
+		s.connect_ex(("127.0.0.1", PORT))
+		fill.append(s)
+	while True:
+		time.sleep(3600)
+else:
+	Server(("127.0.0.1", PORT), Handler).serve_forever()
@@ -0,0 +1,69 @@
+#!/bin/bash
+# tests the download path without network access, by replaying the responses recorded in test_replay.fixture
+
+FIXTURE=$(pwd)/test_replay.fixture
+
+rm -rf tmpreplay &>/dev/null
+mkdir tmpreplay
+cd tmpreplay
+
+function cleanup
+{
+	rm -rf *.bib *.aux dblpbibtex.cfg cache &>/dev/null
+}
+function make_aux_file
+{
+while [ "$1" != "" ]; do
+	echo "\citation{$1}" >> test.aux
+	shift 1
+done
+echo "\bibdata{test}" >> test.aux
+}
+
+# usage: test_replay "extra dblpbibtex.cfg lines" citations...
+function test_replay
+{
+cleanup
+echo "bibtex=true" > dblpbibtex.cfg
+echo "transport=replay" >> dblpbibtex.cfg
+echo "fixturefile=$FIXTURE" >> dblpbibtex.cfg
+echo "cachedir=cache" >> dblpbibtex.cfg
+echo -e "$1" >> dblpbibtex.cfg
+shift 1
+make_aux_file $*
+touch test.bib
+
+../dblpbibtex test &> dblpbibtex.log
+echo "=== test.bib ==="
+cat test.bib
+echo "================"
+}
+
+test_replay "" "DBLP:conf/crypto/StevensBKAM17" "cryptoeprint:2017:190"
+if [ `grep "@inproceedings{DBLP:conf/crypto/StevensBKAM17" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "@misc{cryptoeprint:2017:190" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "0 requests without recorded response" dblpbibtex.log | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+# a key that DBLP reports as not found is not added
+test_replay "" "DBLP:conf/crypto/Missing17" "DBLP:conf/crypto/StevensBKAM17"
+if [ `grep "Missing17" test.bib | wc -l` -ne 0 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "@inproceedings{DBLP:conf/crypto/StevensBKAM17" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+# without recorded response the download fails like a network error
+test_replay "" "DBLP:conf/crypto/Unrecorded17"
+if [ `grep "Unrecorded17" test.bib | wc -l` -ne 0 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "1 requests without recorded response" dblpbibtex.log | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+# a slow primary is hedged to the mirrors, where a redirect and a 404 do not win over the primary
+test_replay "replayhostlatency=https://dblp.org=1500" "DBLP:conf/crypto/StevensBKAM17"
+if [ `grep "@inproceedings{DBLP:conf/crypto/StevensBKAM17" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "Hedged requests: 2 sent to DBLP mirrors, 0 answered first" dblpbibtex.log | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+# a complete answer of a mirror wins over the slow primary
+test_replay "replayhostlatency=https://dblp.org=1500" "DBLP:conf/eurocrypt/StevensKP16"
+if [ `grep "@inproceedings{DBLP:conf/eurocrypt/StevensKP16" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "Hedged requests: 1 sent to DBLP mirrors, 1 answered first" dblpbibtex.log | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+# an invalid number of concurrent downloads is ignored, 0 downloads one at a time
+test_replay "" "dblpbibtex:paralleldownloads:many" "DBLP:conf/crypto/StevensBKAM17"
+if [ `grep "@inproceedings{DBLP:conf/crypto/StevensBKAM17" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+if [ `grep "Ignoring invalid option 'dblpbibtex:paralleldownloads:many'" dblpbibtex.log | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+test_replay "" "dblpbibtex:paralleldownloads:0" "DBLP:conf/crypto/StevensBKAM17"
+if [ `grep "@inproceedings{DBLP:conf/crypto/StevensBKAM17" test.bib | wc -l` -ne 1 ]; then echo "! Failed !"; exit 1; fi
+
+echo "All replay tests passed."